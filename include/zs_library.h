@@ -50,12 +50,15 @@
 //  Opaque class structures to allow forward references
 typedef struct _zs_pipe_t zs_pipe_t;
 #define ZS_PIPE_T_DEFINED
+typedef struct _zs_spsc_t zs_spsc_t;
+#define ZS_SPSC_T_DEFINED
 typedef struct _zs_repl_t zs_repl_t;
 #define ZS_REPL_T_DEFINED
 
 
 //  Public API classes
 #include "zs_pipe.h"
+#include "zs_spsc.h"
 #include "zs_repl.h"
 
 #endif
@@ -24,6 +24,14 @@ extern "C" {
 typedef struct _zs_pipe_t zs_pipe_t;
 #endif
 
+//  Writer function for zs_pipe_paste_to; takes successive pieces of the
+//  pasted pipe contents. Returns 0 if OK, or -1 to stop the paste.
+typedef int (zs_pipe_writer_fn) (void *args, const char *data, size_t size);
+
+//  Destructor for blob data, called when the last value holding the blob
+//  goes, with the data and the hint passed to zs_pipe_send_blob.
+typedef void (zs_pipe_blob_free_fn) (void *data, void *hint);
+
 //  @interface
 //  Create a new zs_pipe, return the reference if successful, or NULL
 //  if construction failed due to lack of available memory.
@@ -34,6 +42,26 @@ zs_pipe_t *
 void
     zs_pipe_destroy (zs_pipe_t **self_p);
 
+//  Keep the ring buffer in a memory-mapped temporary file, rather than on
+//  the heap, once it grows past threshold values; 0 means never, which is
+//  the default. The kernel can then page older values out to disk, so a
+//  pipe can hold more values than fit in memory. String values stay in
+//  memory. Takes effect the next time the ring grows.
+void
+    zs_pipe_set_spill (zs_pipe_t *self, size_t threshold);
+
+//  Set a capacity on the pipe, in values, or 0 for no limit, which is the
+//  default. Sends always succeed, so a pipe can go over its capacity; a
+//  producer checks zs_pipe_full to know when to yield, and a cross-thread
+//  pipe stops consuming into a full pipe.
+void
+    zs_pipe_set_capacity (zs_pipe_t *self, size_t capacity);
+
+//  Returns true if the pipe has a capacity and holds at least that many
+//  values. Returns false otherwise.
+bool
+    zs_pipe_full (zs_pipe_t *self);
+
 //  Send whole number to pipe; this wipes the current pipe register.
 void
     zs_pipe_send_whole (zs_pipe_t *self, int64_t whole);
@@ -46,11 +74,94 @@ void
 void
     zs_pipe_send_string (zs_pipe_t *self, const char *string);
 
+//  Send a blob of binary data to pipe, without copying it. Blobs move from
+//  pipe to pipe by reference. When the last value holding the blob goes,
+//  the pipe calls free_fn, if not NULL, with the data and hint. This wipes
+//  the current pipe register.
+void
+    zs_pipe_send_blob (zs_pipe_t *self, const void *data, size_t size, zs_pipe_blob_free_fn *free_fn, void *hint);
+
+//  Send a chunk to pipe as a blob, without copying it. Takes ownership of
+//  the chunk, and destroys it when the last value holding the blob goes.
+//  Nullifies the caller's reference.
+void
+    zs_pipe_send_chunk (zs_pipe_t *self, zchunk_t **chunk_p);
+
+//  Send the source pipe's register value to the pipe. Strings and blobs are
+//  shared rather than copied, so this is how a function forwards a value
+//  it received. Does nothing if the source register is empty.
+void
+    zs_pipe_forward (zs_pipe_t *self, zs_pipe_t *source);
+
+//  Returns the number of bytes needed to hold a string constant of the given
+//  length, including the terminating null, for zs_pipe_constant_new.
+size_t
+    zs_pipe_constant_size (size_t length);
+
+//  Build a string constant in the caller's buffer, which must be aligned to
+//  8 bytes and have room for zs_pipe_constant_size bytes. The string need
+//  not be null-terminated. Returns the constant, for zs_pipe_send_constant.
+const char *
+    zs_pipe_constant_new (void *buffer, const char *string, size_t length);
+
+//  Send a string constant to pipe, without copying it: the pipe borrows the
+//  constant. The caller must keep the constant unchanged as long as any
+//  pipe may hold it, or call zs_pipe_materialize first. This wipes the
+//  current pipe register.
+void
+    zs_pipe_send_constant (zs_pipe_t *self, const char *constant);
+
+//  Give the pipe its own copy of any string constants it borrowed, so they
+//  outlive the memory they were borrowed from.
+void
+    zs_pipe_materialize (zs_pipe_t *self);
+
+//  Send an array of whole numbers to pipe, in order.
+void
+    zs_pipe_send_wholes (zs_pipe_t *self, const int64_t *wholes, size_t count);
+
+//  Send an array of real numbers to pipe, in order.
+void
+    zs_pipe_send_reals (zs_pipe_t *self, const double *reals, size_t count);
+
 //  Returns true if the pipe contains at least one real number. Returns false
 //  otherwise.
 bool
     zs_pipe_realish (zs_pipe_t *self);
 
+//  Returns the number of values in the pipe, not counting marks.
+size_t
+    zs_pipe_size (zs_pipe_t *self);
+
+//  Returns the number of values of the given type in the pipe, where type is
+//  'w' for whole, 'r' for real, 's' for string, or 'b' for blob; or the
+//  number of phrase marks if type is 'm'. As pulls move type counts along
+//  with values, an atomic can use this to pick a kernel for exactly the
+//  values it gets.
+size_t
+    zs_pipe_count (zs_pipe_t *self, char type);
+
+//  If the next item in the pipe is a phrase mark, rather than a value, takes
+//  it off the pipe and returns true. Otherwise returns false. Use this with
+//  zs_pipe_recv to copy values and marks out of the pipe in order.
+bool
+    zs_pipe_recv_mark (zs_pipe_t *self);
+
+//  Loads the first value in the pipe into the register, without taking it
+//  off the pipe, and sets the pipe's cursor there. Returns true if there
+//  was a value, else false. Read the value with zs_pipe_type, zs_pipe_whole,
+//  and so on. Together with zs_pipe_next, this lets a function make several
+//  passes over its input without copying it. The cursor is valid until the
+//  pipe next changes.
+bool
+    zs_pipe_first (zs_pipe_t *self);
+
+//  Moves the pipe's cursor to the next value and loads it into the register,
+//  without taking it off the pipe. Returns true if there was a value, else
+//  false when the cursor has passed the last value.
+bool
+    zs_pipe_next (zs_pipe_t *self);
+
 //  Receives the next value off the pipe, into the register. Any previous
 //  value in the register is lost. Returns true if a value was successfully
 //  received. If no values were received, returns false. This method does
@@ -58,11 +169,29 @@ bool
 bool
     zs_pipe_recv (zs_pipe_t *self);
 
-//  Returns the type of the register, 'w' for whole, 'r' for real, or 's' for
-//  string. Returns -1 if the register is empty.
+//  Returns the type of the register, 'w' for whole, 'r' for real, 's' for
+//  string, or 'b' for blob. Returns -1 if the register is empty.
 char
     zs_pipe_type (zs_pipe_t *self);
 
+//  Returns the numeric type of the register: 'w' for a whole, or a string
+//  that reads as a whole; 'r' for a real, or a string that reads as a real;
+//  '-' for a string that is not a number, or a blob. Returns -1 if the
+//  register is empty. Strings are parsed once, and the result is kept with
+//  the string.
+char
+    zs_pipe_numeric (zs_pipe_t *self);
+
+//  Returns the data of the blob in the register, or NULL if the register
+//  does not hold a blob. The caller must not modify or free the data.
+const byte *
+    zs_pipe_blob (zs_pipe_t *self);
+
+//  Returns the size of the blob in the register, or zero if the register
+//  does not hold a blob.
+size_t
+    zs_pipe_blob_size (zs_pipe_t *self);
+
 //  Returns the value of the register, coerced to a whole number. This can
 //  cause loss of precision. If no conversion was possible, or the register
 //  is empty, returns zero.
@@ -76,8 +205,8 @@ double
     zs_pipe_real (zs_pipe_t *self);
 
 //  Returns the value of the register, coerced to a string if needed. If the
-//  register is empty, returns an empty string "". The caller must not modify
-//  or free the string.
+//  register is empty, or holds a blob, returns an empty string "". The
+//  caller must not modify or free the string.
 const char *
     zs_pipe_string (zs_pipe_t *self);
 
@@ -97,12 +226,33 @@ double
 const char *
     zs_pipe_recv_string (zs_pipe_t *self);
 
+//  Receives up to limit values off the pipe into the caller's array, coercing
+//  them to wholes if needed. Returns the number of values received, or zero
+//  if the pipe is empty. Skips marks, like zs_pipe_recv, and leaves the
+//  register empty.
+size_t
+    zs_pipe_recv_wholes (zs_pipe_t *self, int64_t *wholes, size_t limit);
+
+//  Receives up to limit values off the pipe into the caller's array, coercing
+//  them to reals if needed. Returns the number of values received, or zero
+//  if the pipe is empty. Skips marks, like zs_pipe_recv, and leaves the
+//  register empty.
+size_t
+    zs_pipe_recv_reals (zs_pipe_t *self, double *reals, size_t limit);
+
 //  Marks an end of phrase in the pipe. This is used to delimit the pipe
 //  as input for later function calls. Marks are ignored when receiving
 //  values off a pipe.
 void
     zs_pipe_mark (zs_pipe_t *self);
 
+//  Make the pipe a copy of the source pipe, values and marks, without copying
+//  the values: the two pipes share the source's ring until either of them
+//  next sends or pulls values into it. This lets several functions each
+//  take the same phrase. Any values already in the pipe are purged.
+void
+    zs_pipe_tee (zs_pipe_t *self, zs_pipe_t *source);
+
 //  Pulls a single value from the source pipe into the pipe. If there was
 //  no value to pull, sends a constant '1' value to the pipe.
 void
@@ -131,11 +281,24 @@ void
 char *
     zs_pipe_paste (zs_pipe_t *self);
 
+//  Write pipe contents to a writer function, in the same format as paste,
+//  in pieces of at most a few KB. Memory use does not depend on the size of
+//  the pipe. This empties the pipe. Returns the number of bytes written, or
+//  -1 if the writer failed.
+int64_t
+    zs_pipe_paste_to (zs_pipe_t *self, zs_pipe_writer_fn *writer, void *args);
+
+//  Write pipe contents to a file descriptor, in the same format as paste.
+//  This empties the pipe. Returns the number of bytes written, or -1 if
+//  there was an error writing to the file descriptor.
+int64_t
+    zs_pipe_paste_fd (zs_pipe_t *self, int fd);
+
 //  Print pipe contents, for debugging, prints nothing if pipe is empty
 void
     zs_pipe_print (zs_pipe_t *self, const char *prefix);
 
-//  Empty the pipe of any values it might contain.
+//  Empty the pipe of any values it might contain, and the register.
 void
     zs_pipe_purge (zs_pipe_t *self);
 
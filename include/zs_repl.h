@@ -64,6 +64,12 @@ const char *
 const char *
     zs_repl_results (zs_repl_t *self);
 
+//  Write pipe results to a file descriptor, after successful execution.
+//  This streams the results rather than building a string. Returns the
+//  number of bytes written, or -1 if there was an error writing.
+int64_t
+    zs_repl_results_fd (zs_repl_t *self, int fd);
+
 //  After a syntax error, return position of syntax error in text.
 uint
     zs_repl_offset (zs_repl_t *self);
@@ -0,0 +1,88 @@
+/*  =========================================================================
+    zs_spsc - ZeroScript cross-thread pipe
+
+    Copyright (c) the Contributors as noted in the AUTHORS file.
+    This file is part of the ZeroScript language, http://zeroscript.org.
+
+    This Source Code Form is subject to the terms of the Mozilla Public
+    License, v. 2.0. If a copy of the MPL was not distributed with this
+    file, You can obtain one at http://mozilla.org/MPL/2.0/.
+    =========================================================================
+*/
+
+#ifndef ZS_SPSC_H_INCLUDED
+#define ZS_SPSC_H_INCLUDED
+
+#include <czmq.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//  Opaque class structure
+#ifndef ZS_SPSC_T_DEFINED
+typedef struct _zs_spsc_t zs_spsc_t;
+#endif
+
+//  @interface
+//  Create a new cross-thread pipe that holds up to limit items, where values
+//  and phrase marks each count as one item. The limit is rounded up to a
+//  power of two. Returns the reference if successful, or NULL if
+//  construction failed due to lack of available memory.
+zs_spsc_t *
+    zs_spsc_new (size_t limit);
+
+//  Destroy the cross-thread pipe and free all memory used by it, including
+//  any items not yet consumed. Neither thread may use the pipe after this.
+void
+    zs_spsc_destroy (zs_spsc_t **self_p);
+
+//  Producer: move as many values and phrase marks as fit from the source
+//  pipe into the cross-thread pipe, and publish them to the consumer in one
+//  step. Returns the number of items moved, which is zero if the cross-
+//  thread pipe is full or the source pipe is empty. Never blocks.
+size_t
+    zs_spsc_publish (zs_spsc_t *self, zs_pipe_t *source);
+
+//  Producer: publish as for zs_spsc_publish, waiting while the cross-thread
+//  pipe is full. Gives up after timeout msecs, or waits forever if timeout
+//  is -1. Returns the number of items moved, which is zero if the timeout
+//  expired or the source pipe is empty.
+size_t
+    zs_spsc_publish_wait (zs_spsc_t *self, zs_pipe_t *source, int timeout);
+
+//  Producer: signal that no more items will be published. Call this after
+//  the last publish.
+void
+    zs_spsc_close (zs_spsc_t *self);
+
+//  Consumer: move all published values and phrase marks into the target
+//  pipe, and release their slots to the producer in one step. If the target
+//  pipe has a capacity, stops when it is full, so a slow consumer holds the
+//  producer back. Returns the number of items moved, which is zero if
+//  nothing was published. Never blocks.
+size_t
+    zs_spsc_consume (zs_spsc_t *self, zs_pipe_t *target);
+
+//  Consumer: consume as for zs_spsc_consume, waiting while there is nothing
+//  to consume. Gives up after timeout msecs, or waits forever if timeout is
+//  -1. Returns the number of items moved, which is zero if the timeout
+//  expired, the target pipe is full, or the producer is done.
+size_t
+    zs_spsc_consume_wait (zs_spsc_t *self, zs_pipe_t *target, int timeout);
+
+//  Consumer: returns true if the producer has closed the pipe and there is
+//  nothing left to consume.
+bool
+    zs_spsc_done (zs_spsc_t *self);
+
+//  Self test of this class
+void
+    zs_spsc_test (bool animate);
+//  @end
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -79,6 +79,18 @@ s_list_possible (void)
 }
 
 
+//  Stream results to stdout as they are formatted, so that large outputs
+//  are never held in memory; ends with a newline if there were results
+
+static void
+s_print_results (void)
+{
+    fflush (stdout);
+    if (zs_repl_results_fd (repl, STDOUT_FILENO) > 0)
+        puts ("");
+}
+
+
 int main (int argc, char *argv [])
 {
     int argn = 1;
@@ -112,11 +124,8 @@ int main (int argc, char *argv [])
         if (zs_repl_execute (repl, input))
             puts ("E: syntax error");
         else
-        if (zs_repl_completed (repl)) {
-            const char *results = zs_repl_results (repl);
-            if (*results)
-                puts (results);
-        }
+        if (zs_repl_completed (repl))
+            s_print_results ();
     }
     else {
         //  If run without arguments, drop into REPL shell
@@ -132,11 +141,8 @@ int main (int argc, char *argv [])
                 puts ("Syntax error");
             }
             else
-            if (zs_repl_completed (repl)) {
-                const char *results = zs_repl_results (repl);
-                if (*results)
-                    puts (results);
-            }
+            if (zs_repl_completed (repl))
+                s_print_results ();
             free (input);
         }
     }
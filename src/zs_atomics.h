@@ -13,6 +13,10 @@
 #ifndef ZS_ATOMICS_H_INCLUDED
 #define ZS_ATOMICS_H_INCLUDED
 
+//  Atomics that work on lists take values off their input in blocks of
+//  this size, so their inner loops work on plain arrays
+#define ATOMIC_BLOCK    256
+
 //  ---------------------------------------------------------------------------
 //  Nullary functions
 
@@ -25,7 +29,9 @@ s_check (zs_vm_t *self, zs_pipe_t *input, zs_pipe_t *output)
         int verbose = (zs_pipe_recv_whole (input) != 0);
         zs_lex_test (verbose);
         zs_pipe_test (verbose);
+        zs_spsc_test (verbose);
         zs_vm_test (verbose);
+        zs_slab_test (verbose);
         zs_repl_test (verbose);
         zs_pipe_send_string (output, "Checks passed successfully");
     }
@@ -51,7 +57,7 @@ static int
 s_times (zs_vm_t *self, zs_pipe_t *input, zs_pipe_t *output)
 {
     if (zs_vm_probing (self))
-        zs_vm_register (self, "times", zs_type_modest, "Loop N times");
+        zs_vm_register_loop (self, "times", zs_loop_times, "Loop N times");
     else {
         int64_t cycles = zs_pipe_recv_whole (input);
         zs_pipe_mark (output);
@@ -74,7 +80,7 @@ static int
 s_count (zs_vm_t *self, zs_pipe_t *input, zs_pipe_t *output)
 {
     if (zs_vm_probing (self))
-        zs_vm_register (self, "count", zs_type_modest, "Loop N times, counting");
+        zs_vm_register_loop (self, "count", zs_loop_count, "Loop N times, counting");
     else {
         int64_t cycles = zs_pipe_recv_whole (input);
         //  Get optional index start and delta from input
@@ -108,7 +114,7 @@ static int
 s_countdown (zs_vm_t *self, zs_pipe_t *input, zs_pipe_t *output)
 {
     if (zs_vm_probing (self))
-        zs_vm_register (self, "countdown", zs_type_modest, "Loop N times, counting dow");
+        zs_vm_register_loop (self, "countdown", zs_loop_countdown, "Loop N times, counting dow");
     else {
         int64_t cycles = zs_pipe_recv_whole (input);
         if (cycles > 0) {
@@ -137,18 +143,24 @@ static int
 s_sum (zs_vm_t *self, zs_pipe_t *input, zs_pipe_t *output)
 {
     if (zs_vm_probing (self))
-        zs_vm_register (self, "sum", zs_type_greedy, "Sum of the values");
+        zs_vm_register_pure (self, "sum", zs_type_greedy, "Sum of the values");
     else
     if (zs_pipe_realish (input)) {
+        double reals [ATOMIC_BLOCK];
         double sum = 0;
-        while (zs_pipe_recv (input))
-            sum += zs_pipe_real (input);
+        size_t count, index;
+        while ((count = zs_pipe_recv_reals (input, reals, ATOMIC_BLOCK)))
+            for (index = 0; index < count; index++)
+                sum += reals [index];
         zs_pipe_send_real (output, sum);
     }
     else {
+        int64_t wholes [ATOMIC_BLOCK];
         int64_t sum = 0;
-        while (zs_pipe_recv (input))
-            sum += zs_pipe_whole (input);
+        size_t count, index;
+        while ((count = zs_pipe_recv_wholes (input, wholes, ATOMIC_BLOCK)))
+            for (index = 0; index < count; index++)
+                sum += wholes [index];
         zs_pipe_send_whole (output, sum);
     }
     return 0;
@@ -158,7 +170,7 @@ static int
 s_product (zs_vm_t *self, zs_pipe_t *input, zs_pipe_t *output)
 {
     if (zs_vm_probing (self))
-        zs_vm_register (self, "product", zs_type_greedy, "Product of the values");
+        zs_vm_register_pure (self, "product", zs_type_greedy, "Product of the values");
     else
     if (zs_pipe_realish (input)) {
         double product = 1;
@@ -179,12 +191,10 @@ static int
 s_tally (zs_vm_t *self, zs_pipe_t *input, zs_pipe_t *output)
 {
     if (zs_vm_probing (self))
-        zs_vm_register (self, "tally", zs_type_greedy, "Number of values");
+        zs_vm_register_pure (self, "tally", zs_type_greedy, "Number of values");
     else {
-        int64_t tally = 0;
-        while (zs_pipe_recv (input))
-            tally++;
-        zs_pipe_send_whole (output, tally);
+        zs_pipe_send_whole (output, zs_pipe_size (input));
+        zs_pipe_purge (input);
     }
     return 0;
 }
@@ -193,13 +203,16 @@ static int
 s_mean (zs_vm_t *self, zs_pipe_t *input, zs_pipe_t *output)
 {
     if (zs_vm_probing (self))
-        zs_vm_register (self, "mean", zs_type_greedy, "Mean of the values");
+        zs_vm_register_pure (self, "mean", zs_type_greedy, "Mean of the values");
     else {
+        double reals [ATOMIC_BLOCK];
         double total = 0;
         double tally = 0;
-        while (zs_pipe_recv (input)) {
-            total += zs_pipe_real (input);
-            tally++;
+        size_t count, index;
+        while ((count = zs_pipe_recv_reals (input, reals, ATOMIC_BLOCK))) {
+            for (index = 0; index < count; index++)
+                total += reals [index];
+            tally += count;
         }
         zs_pipe_send_real (output, total / tally);
     }
@@ -210,22 +223,26 @@ static int
 s_min (zs_vm_t *self, zs_pipe_t *input, zs_pipe_t *output)
 {
     if (zs_vm_probing (self))
-        zs_vm_register (self, "min", zs_type_greedy, "Minimum of the values");
+        zs_vm_register_pure (self, "min", zs_type_greedy, "Minimum of the values");
     else
     if (zs_pipe_realish (input)) {
+        double reals [ATOMIC_BLOCK];
         double result = zs_pipe_recv_whole (input);
-        while (zs_pipe_recv (input)) {
-            if (result > zs_pipe_real (input))
-                result = zs_pipe_real (input);
-        }
+        size_t count, index;
+        while ((count = zs_pipe_recv_reals (input, reals, ATOMIC_BLOCK)))
+            for (index = 0; index < count; index++)
+                if (result > reals [index])
+                    result = reals [index];
         zs_pipe_send_real (output, result);
     }
     else {
+        int64_t wholes [ATOMIC_BLOCK];
         int64_t result = zs_pipe_recv_whole (input);
-        while (zs_pipe_recv (input)) {
-            if (result > zs_pipe_whole (input))
-                result = zs_pipe_whole (input);
-        }
+        size_t count, index;
+        while ((count = zs_pipe_recv_wholes (input, wholes, ATOMIC_BLOCK)))
+            for (index = 0; index < count; index++)
+                if (result > wholes [index])
+                    result = wholes [index];
         zs_pipe_send_whole (output, result);
     }
     return 0;
@@ -235,22 +252,26 @@ static int
 s_max (zs_vm_t *self, zs_pipe_t *input, zs_pipe_t *output)
 {
     if (zs_vm_probing (self))
-        zs_vm_register (self, "max", zs_type_greedy, "Maximum of the values");
+        zs_vm_register_pure (self, "max", zs_type_greedy, "Maximum of the values");
     else
     if (zs_pipe_realish (input)) {
+        double reals [ATOMIC_BLOCK];
         double result = zs_pipe_recv_whole (input);
-        while (zs_pipe_recv (input)) {
-            if (result < zs_pipe_real (input))
-                result = zs_pipe_real (input);
-        }
+        size_t count, index;
+        while ((count = zs_pipe_recv_reals (input, reals, ATOMIC_BLOCK)))
+            for (index = 0; index < count; index++)
+                if (result < reals [index])
+                    result = reals [index];
         zs_pipe_send_real (output, result);
     }
     else {
+        int64_t wholes [ATOMIC_BLOCK];
         int64_t result = zs_pipe_recv_whole (input);
-        while (zs_pipe_recv (input)) {
-            if (result < zs_pipe_whole (input))
-                result = zs_pipe_whole (input);
-        }
+        size_t count, index;
+        while ((count = zs_pipe_recv_wholes (input, wholes, ATOMIC_BLOCK)))
+            for (index = 0; index < count; index++)
+                if (result < wholes [index])
+                    result = wholes [index];
         zs_pipe_send_whole (output, result);
     }
     return 0;
@@ -261,22 +282,32 @@ s_assert (zs_vm_t *self, zs_pipe_t *input, zs_pipe_t *output)
 {
     if (zs_vm_probing (self))
         zs_vm_register (self, "assert", zs_type_greedy, "Assert first two values are the same");
-    else
-    if (zs_pipe_realish (input)) {
-        double first = zs_pipe_recv_real (input);
-        double second = zs_pipe_recv_real (input);
-        if (first != second) {
-            printf ("E: assertion failed, %g != %g\n", first, second);
-            return -1;          //  Destroy the thread
-        }
-    }
     else {
-        int64_t first = zs_pipe_recv_whole (input);
-        int64_t second = zs_pipe_recv_whole (input);
-        if (first != second) {
-            printf ("E: assertion failed, %" PRId64 " != %" PRId64 "\n", first, second);
-            return -1;          //  Destroy the thread
+        //  Compare the first two values where they sit, with a cursor,
+        //  rather than taking copies off the pipe
+        if (zs_pipe_realish (input)) {
+            zs_pipe_first (input);
+            double first = zs_pipe_real (input);
+            zs_pipe_next (input);
+            double second = zs_pipe_real (input);
+            if (first != second) {
+                printf ("E: assertion failed, %g != %g\n", first, second);
+                return -1;      //  Destroy the thread
+            }
         }
+        else {
+            zs_pipe_first (input);
+            int64_t first = zs_pipe_whole (input);
+            zs_pipe_next (input);
+            int64_t second = zs_pipe_whole (input);
+            if (first != second) {
+                printf ("E: assertion failed, %" PRId64 " != %" PRId64 "\n", first, second);
+                return -1;      //  Destroy the thread
+            }
+        }
+        //  Assert uses up the two values; any others feed the next function
+        zs_pipe_recv (input);
+        zs_pipe_recv (input);
     }
     return 0;
 }
@@ -285,10 +316,12 @@ static int
 s_whole (zs_vm_t *self, zs_pipe_t *input, zs_pipe_t *output)
 {
     if (zs_vm_probing (self))
-        zs_vm_register (self, "whole", zs_type_greedy, "Coerce values to whole numbers");
+        zs_vm_register_pure (self, "whole", zs_type_greedy, "Coerce values to whole numbers");
     else {
-        while (zs_pipe_recv (input))
-            zs_pipe_send_whole (output, zs_pipe_whole (input));
+        int64_t wholes [ATOMIC_BLOCK];
+        size_t count;
+        while ((count = zs_pipe_recv_wholes (input, wholes, ATOMIC_BLOCK)))
+            zs_pipe_send_wholes (output, wholes, count);
     }
     return 0;
 }
@@ -301,19 +334,29 @@ static int
 s_add (zs_vm_t *self, zs_pipe_t *input, zs_pipe_t *output)
 {
     if (zs_vm_probing (self)) {
-        zs_vm_register (self, "+", zs_type_array, "Add value to all");
-        zs_vm_register (self, "add", zs_type_array, NULL);
+        zs_vm_register_pure (self, "+", zs_type_array, "Add value to all");
+        zs_vm_register_pure (self, "add", zs_type_array, NULL);
     }
     else
     if (zs_pipe_realish (input)) {
+        double reals [ATOMIC_BLOCK];
         double operand = zs_pipe_recv_real (input);
-        while (zs_pipe_recv (input))
-            zs_pipe_send_real (output, zs_pipe_real (input) + operand);
+        size_t count, index;
+        while ((count = zs_pipe_recv_reals (input, reals, ATOMIC_BLOCK))) {
+            for (index = 0; index < count; index++)
+                reals [index] += operand;
+            zs_pipe_send_reals (output, reals, count);
+        }
     }
     else {
+        int64_t wholes [ATOMIC_BLOCK];
         int64_t operand = zs_pipe_recv_whole (input);
-        while (zs_pipe_recv (input))
-            zs_pipe_send_whole (output, zs_pipe_whole (input) + operand);
+        size_t count, index;
+        while ((count = zs_pipe_recv_wholes (input, wholes, ATOMIC_BLOCK))) {
+            for (index = 0; index < count; index++)
+                wholes [index] += operand;
+            zs_pipe_send_wholes (output, wholes, count);
+        }
     }
     return 0;
 }
@@ -322,19 +365,29 @@ static int
 s_subtract (zs_vm_t *self, zs_pipe_t *input, zs_pipe_t *output)
 {
     if (zs_vm_probing (self)) {
-        zs_vm_register (self, "-", zs_type_array, "Subtract value from all");
-        zs_vm_register (self, "subtract", zs_type_array, NULL);
+        zs_vm_register_pure (self, "-", zs_type_array, "Subtract value from all");
+        zs_vm_register_pure (self, "subtract", zs_type_array, NULL);
     }
     else
     if (zs_pipe_realish (input)) {
+        double reals [ATOMIC_BLOCK];
         double operand = zs_pipe_recv_real (input);
-        while (zs_pipe_recv (input))
-            zs_pipe_send_real (output, zs_pipe_real (input) - operand);
+        size_t count, index;
+        while ((count = zs_pipe_recv_reals (input, reals, ATOMIC_BLOCK))) {
+            for (index = 0; index < count; index++)
+                reals [index] -= operand;
+            zs_pipe_send_reals (output, reals, count);
+        }
     }
     else {
+        int64_t wholes [ATOMIC_BLOCK];
         int64_t operand = zs_pipe_recv_whole (input);
-        while (zs_pipe_recv (input))
-            zs_pipe_send_whole (output, zs_pipe_whole (input) - operand);
+        size_t count, index;
+        while ((count = zs_pipe_recv_wholes (input, wholes, ATOMIC_BLOCK))) {
+            for (index = 0; index < count; index++)
+                wholes [index] -= operand;
+            zs_pipe_send_wholes (output, wholes, count);
+        }
     }
     return 0;
 }
@@ -343,20 +396,30 @@ static int
 s_multiply (zs_vm_t *self, zs_pipe_t *input, zs_pipe_t *output)
 {
     if (zs_vm_probing (self)) {
-        zs_vm_register (self, "*", zs_type_array, "Multiply value by all");
-        zs_vm_register (self, "x", zs_type_array, NULL);
-        zs_vm_register (self, "multiply", zs_type_array, NULL);
+        zs_vm_register_pure (self, "*", zs_type_array, "Multiply value by all");
+        zs_vm_register_pure (self, "x", zs_type_array, NULL);
+        zs_vm_register_pure (self, "multiply", zs_type_array, NULL);
     }
     else
     if (zs_pipe_realish (input)) {
+        double reals [ATOMIC_BLOCK];
         double operand = zs_pipe_recv_real (input);
-        while (zs_pipe_recv (input))
-            zs_pipe_send_real (output, zs_pipe_real (input) * operand);
+        size_t count, index;
+        while ((count = zs_pipe_recv_reals (input, reals, ATOMIC_BLOCK))) {
+            for (index = 0; index < count; index++)
+                reals [index] *= operand;
+            zs_pipe_send_reals (output, reals, count);
+        }
     }
     else {
+        int64_t wholes [ATOMIC_BLOCK];
         int64_t operand = zs_pipe_recv_whole (input);
-        while (zs_pipe_recv (input))
-            zs_pipe_send_whole (output, zs_pipe_whole (input) * operand);
+        size_t count, index;
+        while ((count = zs_pipe_recv_wholes (input, wholes, ATOMIC_BLOCK))) {
+            for (index = 0; index < count; index++)
+                wholes [index] *= operand;
+            zs_pipe_send_wholes (output, wholes, count);
+        }
     }
     return 0;
 }
@@ -365,13 +428,18 @@ static int
 s_divide (zs_vm_t *self, zs_pipe_t *input, zs_pipe_t *output)
 {
     if (zs_vm_probing (self)) {
-        zs_vm_register (self, "/", zs_type_array, "Divide value into all");
-        zs_vm_register (self, "divide", zs_type_array, NULL);
+        zs_vm_register_pure (self, "/", zs_type_array, "Divide value into all");
+        zs_vm_register_pure (self, "divide", zs_type_array, NULL);
     }
     else {
+        double reals [ATOMIC_BLOCK];
         double operand = zs_pipe_recv_real (input);
-        while (zs_pipe_recv (input))
-            zs_pipe_send_real (output, zs_pipe_real (input) / operand);
+        size_t count, index;
+        while ((count = zs_pipe_recv_reals (input, reals, ATOMIC_BLOCK))) {
+            for (index = 0; index < count; index++)
+                reals [index] /= operand;
+            zs_pipe_send_reals (output, reals, count);
+        }
     }
     return 0;
 }
@@ -22,6 +22,7 @@
 
 //  Internal API
 #include "zs_vm.h"
+#include "zs_slab.h"
 #include "zs_lex.h"
 
 #endif
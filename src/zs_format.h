@@ -0,0 +1,390 @@
+/*  =========================================================================
+    zs_format - ZeroScript number formatting
+
+    Copyright (c) the Contributors as noted in the AUTHORS file.
+    This file is part of the ZeroScript language, http://zeroscript.org.
+
+    This Source Code Form is subject to the terms of the Mozilla Public
+    License, v. 2.0. If a copy of the MPL was not distributed with this
+    file, You can obtain one at http://mozilla.org/MPL/2.0/.
+    =========================================================================
+*/
+
+/*
+    Formats wholes and reals as text without going through snprintf. The
+    output does not depend on the locale.
+
+    Wholes are written two digits at a time from a table of digit pairs.
+
+    Reals are written with the fewest digits that read back as the same
+    double, using Florian Loitsch's Grisu2 algorithm ("Printing Floating-
+    Point Numbers Quickly and Accurately with Integers", PLDI 2010), after
+    Milo Yip's implementation. Grisu2 output always reads back exactly; in
+    rare cases it is one digit longer than the shortest. The layout follows
+    %g at 17 digits of precision: plain notation for exponents from -4 to
+    16, else d.ddde+XX, with no trailing zeros.
+*/
+
+#ifndef ZS_FORMAT_H_INCLUDED
+#define ZS_FORMAT_H_INCLUDED
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+//  Buffer size that holds any formatted whole or real, with null
+#define FORMAT_MAX      32
+
+static const char
+s_digit_pairs [201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+//  Format an unsigned number into buffer, with no terminating null.
+//  Returns number of characters written.
+
+static size_t
+s_format_unsigned (uint64_t number, char *buffer)
+{
+    //  Write digits backwards into scratch, then copy out
+    char scratch [20];
+    char *digit = scratch + sizeof (scratch);
+    while (number >= 100) {
+        const char *pair = s_digit_pairs + (number % 100) * 2;
+        number /= 100;
+        *--digit = pair [1];
+        *--digit = pair [0];
+    }
+    if (number >= 10) {
+        const char *pair = s_digit_pairs + number * 2;
+        *--digit = pair [1];
+        *--digit = pair [0];
+    }
+    else
+        *--digit = (char) ('0' + number);
+
+    size_t length = scratch + sizeof (scratch) - digit;
+    memcpy (buffer, digit, length);
+    return length;
+}
+
+//  Format a whole number into buffer, which must hold FORMAT_MAX bytes.
+//  Returns length of string, not counting the terminating null.
+
+static size_t
+s_format_whole (int64_t whole, char *buffer)
+{
+    size_t length = 0;
+    uint64_t number = (uint64_t) whole;
+    if (whole < 0) {
+        buffer [length++] = '-';
+        number = 0 - number;
+    }
+    length += s_format_unsigned (number, buffer + length);
+    buffer [length] = 0;
+    return length;
+}
+
+
+//  ---------------------------------------------------------------------------
+//  Grisu2 works on "do-it-yourself" floating point numbers, which hold a
+//  64-bit significand f and a binary exponent e, for the value f * 2^e.
+
+typedef struct {
+    uint64_t f;
+    int e;
+} diy_fp_t;
+
+#define DP_SIGNIFICAND_MASK     0x000FFFFFFFFFFFFFULL
+#define DP_HIDDEN_BIT           0x0010000000000000ULL
+#define DP_EXPONENT_BIAS        (0x3FF + 52)
+
+static inline diy_fp_t
+s_diy_fp (uint64_t f, int e)
+{
+    diy_fp_t fp = { f, e };
+    return fp;
+}
+
+//  Product of two numbers, rounded to 64 bits of significand
+
+static inline diy_fp_t
+s_diy_fp_multiply (diy_fp_t x, diy_fp_t y)
+{
+    const uint64_t M32 = 0xFFFFFFFF;
+    uint64_t a = x.f >> 32, b = x.f & M32;
+    uint64_t c = y.f >> 32, d = y.f & M32;
+    uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+    uint64_t tmp = (bd >> 32) + (ad & M32) + (bc & M32);
+    tmp += 1U << 31;            //  Round
+    return s_diy_fp (ac + (ad >> 32) + (bc >> 32) + (tmp >> 32), x.e + y.e + 64);
+}
+
+static inline diy_fp_t
+s_diy_fp_normalize (diy_fp_t x)
+{
+    while (!(x.f & 0x8000000000000000ULL)) {
+        x.f <<= 1;
+        x.e--;
+    }
+    return x;
+}
+
+//  Powers of ten, 10^k for k = -348, -340, ... 340, normalized
+static const uint64_t
+s_cached_powers_f [] = {
+    0xfa8fd5a0081c0288ULL, 0xbaaee17fa23ebf76ULL, 0x8b16fb203055ac76ULL,
+    0xcf42894a5dce35eaULL, 0x9a6bb0aa55653b2dULL, 0xe61acf033d1a45dfULL,
+    0xab70fe17c79ac6caULL, 0xff77b1fcbebcdc4fULL, 0xbe5691ef416bd60cULL,
+    0x8dd01fad907ffc3cULL, 0xd3515c2831559a83ULL, 0x9d71ac8fada6c9b5ULL,
+    0xea9c227723ee8bcbULL, 0xaecc49914078536dULL, 0x823c12795db6ce57ULL,
+    0xc21094364dfb5637ULL, 0x9096ea6f3848984fULL, 0xd77485cb25823ac7ULL,
+    0xa086cfcd97bf97f4ULL, 0xef340a98172aace5ULL, 0xb23867fb2a35b28eULL,
+    0x84c8d4dfd2c63f3bULL, 0xc5dd44271ad3cdbaULL, 0x936b9fcebb25c996ULL,
+    0xdbac6c247d62a584ULL, 0xa3ab66580d5fdaf6ULL, 0xf3e2f893dec3f126ULL,
+    0xb5b5ada8aaff80b8ULL, 0x87625f056c7c4a8bULL, 0xc9bcff6034c13053ULL,
+    0x964e858c91ba2655ULL, 0xdff9772470297ebdULL, 0xa6dfbd9fb8e5b88fULL,
+    0xf8a95fcf88747d94ULL, 0xb94470938fa89bcfULL, 0x8a08f0f8bf0f156bULL,
+    0xcdb02555653131b6ULL, 0x993fe2c6d07b7facULL, 0xe45c10c42a2b3b06ULL,
+    0xaa242499697392d3ULL, 0xfd87b5f28300ca0eULL, 0xbce5086492111aebULL,
+    0x8cbccc096f5088ccULL, 0xd1b71758e219652cULL, 0x9c40000000000000ULL,
+    0xe8d4a51000000000ULL, 0xad78ebc5ac620000ULL, 0x813f3978f8940984ULL,
+    0xc097ce7bc90715b3ULL, 0x8f7e32ce7bea5c70ULL, 0xd5d238a4abe98068ULL,
+    0x9f4f2726179a2245ULL, 0xed63a231d4c4fb27ULL, 0xb0de65388cc8ada8ULL,
+    0x83c7088e1aab65dbULL, 0xc45d1df942711d9aULL, 0x924d692ca61be758ULL,
+    0xda01ee641a708deaULL, 0xa26da3999aef774aULL, 0xf209787bb47d6b85ULL,
+    0xb454e4a179dd1877ULL, 0x865b86925b9bc5c2ULL, 0xc83553c5c8965d3dULL,
+    0x952ab45cfa97a0b3ULL, 0xde469fbd99a05fe3ULL, 0xa59bc234db398c25ULL,
+    0xf6c69a72a3989f5cULL, 0xb7dcbf5354e9beceULL, 0x88fcf317f22241e2ULL,
+    0xcc20ce9bd35c78a5ULL, 0x98165af37b2153dfULL, 0xe2a0b5dc971f303aULL,
+    0xa8d9d1535ce3b396ULL, 0xfb9b7cd9a4a7443cULL, 0xbb764c4ca7a44410ULL,
+    0x8bab8eefb6409c1aULL, 0xd01fef10a657842cULL, 0x9b10a4e5e9913129ULL,
+    0xe7109bfba19c0c9dULL, 0xac2820d9623bf429ULL, 0x80444b5e7aa7cf85ULL,
+    0xbf21e44003acdd2dULL, 0x8e679c2f5e44ff8fULL, 0xd433179d9c8cb841ULL,
+    0x9e19db92b4e31ba9ULL, 0xeb96bf6ebadf77d9ULL, 0xaf87023b9bf0ee6bULL
+};
+static const int16_t
+s_cached_powers_e [] = {
+    -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007,  -980,
+     -954,  -927,  -901,  -874,  -847,  -821,  -794,  -768,  -741,  -715,
+     -688,  -661,  -635,  -608,  -582,  -555,  -529,  -502,  -475,  -449,
+     -422,  -396,  -369,  -343,  -316,  -289,  -263,  -236,  -210,  -183,
+     -157,  -130,  -103,   -77,   -50,   -24,     3,    30,    56,    83,
+      109,   136,   162,   189,   216,   242,   269,   295,   322,   348,
+      375,   402,   428,   455,   481,   508,   534,   561,   588,   614,
+      641,   667,   694,   720,   747,   774,   800,   827,   853,   880,
+      907,   933,   960,   986,  1013,  1039,  1066
+};
+
+//  Return the power of ten that brings a number with binary exponent e into
+//  the range digit generation needs, and set K to its decimal exponent,
+//  negated.
+
+static inline diy_fp_t
+s_cached_power (int e, int *K)
+{
+    double dk = (-61 - e) * 0.30102999566398114 + 347;
+    int k = (int) dk;
+    if (dk - k > 0.0)
+        k++;
+    unsigned index = (unsigned) ((k >> 3) + 1);
+    *K = -(-348 + (int) (index << 3));
+    return s_diy_fp (s_cached_powers_f [index], s_cached_powers_e [index]);
+}
+
+//  Powers of ten up to 10^19, the most that fits in 64 bits
+
+static const uint64_t
+s_pow10 [] = {
+    1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL,
+    10000000ULL, 100000000ULL, 1000000000ULL, 10000000000ULL,
+    100000000000ULL, 1000000000000ULL, 10000000000000ULL,
+    100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL,
+    100000000000000000ULL, 1000000000000000000ULL,
+    10000000000000000000ULL
+};
+
+//  Nudge the last digit down while that brings us closer to the true value
+
+static inline void
+s_grisu_round (char *buffer, int length, uint64_t delta, uint64_t rest,
+               uint64_t ten_kappa, uint64_t wp_w)
+{
+    while (rest < wp_w && delta - rest >= ten_kappa
+       && (rest + ten_kappa < wp_w || wp_w - rest > rest + ten_kappa - wp_w)) {
+        buffer [length - 1]--;
+        rest += ten_kappa;
+    }
+}
+
+//  Generate digits of Mp until they are within delta of it, and so inside
+//  the rounding interval
+
+static void
+s_digit_gen (diy_fp_t W, diy_fp_t Mp, uint64_t delta,
+             char *buffer, int *length, int *K)
+{
+    diy_fp_t one = s_diy_fp (1ULL << -Mp.e, Mp.e);
+    uint64_t wp_w = Mp.f - W.f;
+    uint32_t p1 = (uint32_t) (Mp.f >> -one.e);
+    uint64_t p2 = Mp.f & (one.f - 1);
+    int kappa = 1;
+    while (kappa < 10 && p1 >= s_pow10 [kappa])
+        kappa++;
+
+    *length = 0;
+    while (kappa > 0) {
+        uint32_t digit = (uint32_t) (p1 / s_pow10 [kappa - 1]);
+        p1 = (uint32_t) (p1 % s_pow10 [kappa - 1]);
+        if (digit || *length)
+            buffer [(*length)++] = (char) ('0' + digit);
+        kappa--;
+        uint64_t rest = ((uint64_t) p1 << -one.e) + p2;
+        if (rest <= delta) {
+            *K += kappa;
+            s_grisu_round (buffer, *length, delta, rest,
+                           s_pow10 [kappa] << -one.e, wp_w);
+            return;
+        }
+    }
+    while (true) {
+        p2 *= 10;
+        delta *= 10;
+        char digit = (char) (p2 >> -one.e);
+        if (digit || *length)
+            buffer [(*length)++] = (char) ('0' + digit);
+        p2 &= one.f - 1;
+        kappa--;
+        if (p2 < delta) {
+            *K += kappa;
+            int index = -kappa;
+            s_grisu_round (buffer, *length, delta, p2, one.f,
+                           wp_w * (index < 20? s_pow10 [index]: 0));
+            return;
+        }
+    }
+}
+
+//  Produce the shortest digits for a positive, finite, non-zero real, so
+//  that the value is digits * 10^K. Buffer must hold 18 digits.
+
+static void
+s_grisu2 (double real, char *buffer, int *length, int *K)
+{
+    uint64_t bits;
+    memcpy (&bits, &real, sizeof (bits));
+    int biased_e = (int) ((bits >> 52) & 0x7FF);
+    uint64_t significand = bits & DP_SIGNIFICAND_MASK;
+    diy_fp_t v = biased_e?
+        s_diy_fp (significand + DP_HIDDEN_BIT, biased_e - DP_EXPONENT_BIAS):
+        s_diy_fp (significand, 1 - DP_EXPONENT_BIAS);
+
+    //  Boundaries halfway to the neighbouring doubles, on one exponent
+    diy_fp_t w_plus = s_diy_fp ((v.f << 1) + 1, v.e - 1);
+    while (!(w_plus.f & (DP_HIDDEN_BIT << 1))) {
+        w_plus.f <<= 1;
+        w_plus.e--;
+    }
+    w_plus.f <<= 64 - 52 - 2;
+    w_plus.e -= 64 - 52 - 2;
+    diy_fp_t w_minus = v.f == DP_HIDDEN_BIT?
+        s_diy_fp ((v.f << 2) - 1, v.e - 2):
+        s_diy_fp ((v.f << 1) - 1, v.e - 1);
+    w_minus.f <<= w_minus.e - w_plus.e;
+    w_minus.e = w_plus.e;
+
+    diy_fp_t c_mk = s_cached_power (w_plus.e, K);
+    diy_fp_t W = s_diy_fp_multiply (s_diy_fp_normalize (v), c_mk);
+    diy_fp_t Wp = s_diy_fp_multiply (w_plus, c_mk);
+    diy_fp_t Wm = s_diy_fp_multiply (w_minus, c_mk);
+    Wm.f++;
+    Wp.f--;
+    s_digit_gen (W, Wp, Wp.f - Wm.f, buffer, length, K);
+}
+
+//  Format a real number into buffer, which must hold FORMAT_MAX bytes.
+//  Returns length of string, not counting the terminating null.
+
+static size_t
+s_format_real (double real, char *buffer)
+{
+    char *start = buffer;
+    if (isnan (real)) {
+        memcpy (buffer, "nan", 4);
+        return 3;
+    }
+    if (signbit (real)) {
+        *buffer++ = '-';
+        real = -real;
+    }
+    if (isinf (real)) {
+        memcpy (buffer, "inf", 4);
+        return buffer + 3 - start;
+    }
+    if (real == 0) {
+        *buffer++ = '0';
+        *buffer = 0;
+        return buffer - start;
+    }
+    char digits [20];
+    int length, K;
+    s_grisu2 (real, digits, &length, &K);
+
+    //  Decimal exponent of the first digit
+    int exponent = length + K - 1;
+    if (exponent < -4 || exponent > 16) {
+        //  d.ddde+XX
+        *buffer++ = digits [0];
+        if (length > 1) {
+            *buffer++ = '.';
+            memcpy (buffer, digits + 1, length - 1);
+            buffer += length - 1;
+        }
+        *buffer++ = 'e';
+        *buffer++ = exponent < 0? '-': '+';
+        if (exponent < 0)
+            exponent = -exponent;
+        if (exponent < 10)
+            *buffer++ = '0';
+        buffer += s_format_unsigned (exponent, buffer);
+    }
+    else
+    if (exponent < 0) {
+        //  0.000ddd
+        *buffer++ = '0';
+        *buffer++ = '.';
+        memset (buffer, '0', -exponent - 1);
+        buffer += -exponent - 1;
+        memcpy (buffer, digits, length);
+        buffer += length;
+    }
+    else
+    if (exponent + 1 >= length) {
+        //  ddd000
+        memcpy (buffer, digits, length);
+        buffer += length;
+        memset (buffer, '0', exponent + 1 - length);
+        buffer += exponent + 1 - length;
+    }
+    else {
+        //  ddd.ddd
+        memcpy (buffer, digits, exponent + 1);
+        buffer += exponent + 1;
+        *buffer++ = '.';
+        memcpy (buffer, digits + exponent + 1, length - exponent - 1);
+        buffer += length - exponent - 1;
+    }
+    *buffer = 0;
+    return buffer - start;
+}
+
+#endif
@@ -12,74 +12,565 @@
 
 /*
 @header
-    A pipe is an ordered list of strings and wholes.
+    A pipe is an ordered list of wholes, reals, strings, and blobs.
 @discuss
+    Values are held in a growable ring buffer, so sending and receiving
+    numbers does not touch the heap once the ring is big enough. Pulls take
+    values off the tail of the source pipe, and receives take them off the
+    head.
+
+    Phrase marks are not stored in the ring. Instead the pipe keeps an index
+    of marks, each holding the position of the value that follows it. Every
+    value has a position, counting from the start of the pipe's life, so
+    marks stay valid as values come and go at either end. Finding the start
+    of the current or previous phrase is then a lookup at the end of the
+    index, rather than a walk back through the values.
+
+    The pipe counts values by type as a running census: one for all values
+    sent to the tail, one for all values taken off the head, and one in each
+    mark. The difference between two of these gives the census of a range,
+    so a pull can splice a whole phrase, and its type counts, from one pipe
+    to another with a memcpy and a few subtractions.
+
+    A tee shares one ring between several pipes, each with its own view of
+    the values. The pipes only read the shared ring; one that is about to
+    write to it takes its own copy first. Each pipe holds its own reference
+    to every string in its view, so receiving and freeing values work the
+    same whether the ring is shared or not.
+
+    A pipe can also borrow a string constant, such as one compiled into VM
+    code, instead of copying it. A constant has the same header as other
+    strings, with a reference count of zero, so we never free it. The owner
+    of the constant materializes borrowed strings before it lets go of the
+    memory.
+
+    A pipe can spill its ring to disk: past a threshold, we map the ring onto
+    an unlinked temporary file instead of allocating it on the heap. Values
+    are still read and written in place, and the kernel decides which pages
+    to keep in memory.
 @end
 */
 
 #include "zs_classes.h"
 #include "zs_strtod.c"
+#include "zs_format.h"
+#if defined (__UNIX__)
+#   include <sys/mman.h>
+#endif
 
 
-//  This holds an item in our value queue
+//  This holds an item in our value queue. Only one field is ever live, so
+//  we overlay them; a value then takes 16 bytes on 64-bit systems and four
+//  values share each cache line.
 typedef struct {
-    int64_t whole;
-    double real;
-    char *string;               //  Points to byte after 'type'
-    char type;                  //  Keep this at the end of the structure
+    union {
+        int64_t whole;          //  Type 'w'
+        double real;            //  Type 'r'
+        char *string;           //  Type 's', copy of string from slab
+        struct _blob_t *blob;   //  Type 'b', shared binary data
+    };
+    char type;                  //  'w', 'r', 's', or 'b'
 } value_t;
 
+//  A blob value refers to binary data that the pipe does not copy. Values
+//  share the blob, and the last one to go calls the destructor.
+typedef struct _blob_t {
+    size_t refs;                //  Number of values holding the blob
+    const byte *data;           //  Blob data, owned by the caller
+    size_t size;                //  Size of data, in bytes
+    zs_pipe_blob_free_fn *free_fn;
+    void *hint;                 //  Argument for destructor
+} blob_t;
+
+//  Each string value sits just after this header, which caches the string's
+//  numeric value. We parse the string the first time it's coerced to a
+//  number, so later coercions, as the string moves from pipe to pipe, are
+//  free.
+typedef struct {
+    int64_t whole;              //  String coerced to whole
+    double real;                //  String coerced to real
+    unsigned int refs;          //  Values holding string, 0 for constants
+    char numeric;               //  0 until parsed, then 'w', 'r', or '-'
+} string_header_t;
+
+//  Running count of values by type, see @discuss
+typedef struct {
+    size_t wholes;
+    size_t reals;
+    size_t strings;
+    size_t blobs;
+} census_t;
+
+//  This holds a phrase mark, which sits before the value at its position
+typedef struct {
+    size_t position;            //  Position of following value
+    census_t census;            //  Census of all values before mark
+} mark_t;
+
+//  Initial size of ring buffer; we double it each time it fills up
+#define PIPE_LIMIT      64
+//  Initial size of mark index; we double this as needed too
+#define MARKS_LIMIT     16
+//  Size of buffer that paste fills before passing it to the writer
+#define PASTE_BUFFER    4096
+
 //  Structure of our class
 struct _zs_pipe_t {
-    zlistx_t *values;           //  Simple stupid implementation
-    value_t *value;             //  Register value, if any
-    char string_value [30];     //  Register value as string
-    size_t nbr_reals;           //  Number of reals on the pipe
+    value_t *values;            //  Ring buffer of values
+    size_t *share;              //  Pipes sharing ring, or NULL if only us
+    size_t limit;               //  Allocated slots, always a power of two
+    size_t spill;               //  Spill threshold, or 0 for never
+    bool spilled;               //  Ring is mapped to a temporary file
+    size_t head;                //  Slot of first value in ring
+    size_t size;                //  Number of values in ring
+    size_t base;                //  Position of first value in ring
+    mark_t *marks;              //  Index of marks, in pipe order
+    size_t marks_head;          //  First live entry in mark index
+    size_t marks_tail;          //  Entry after last live mark
+    size_t marks_limit;         //  Allocated entries in mark index
+    census_t sent;              //  Census of values sent to tail
+    census_t taken;             //  Census of values taken off head
+    zs_slab_t *slab;            //  Slab for strings, or NULL for heap
+    size_t capacity;            //  Capacity, or 0 for no limit
+    size_t cursor;              //  Index of value in register, when peeking
+    value_t value;              //  Register value; type 0 means empty
+    char string_value [FORMAT_MAX];     //  Register value as string
 };
 
-static value_t *
-s_value_new (const char *string)
+//  Add values of the given type to a census
+
+static inline void
+s_census_add (census_t *self, char type, size_t count)
 {
-    value_t *self = (value_t *) zmalloc (sizeof (value_t) + (string? strlen (string) + 1: 0));
-    return self;
+    if (type == 'w')
+        self->wholes += count;
+    else
+    if (type == 'r')
+        self->reals += count;
+    else
+    if (type == 's')
+        self->strings += count;
+    else
+        self->blobs += count;
+}
+
+//  Remove values of the given type from a census
+
+static inline void
+s_census_sub (census_t *self, char type, size_t count)
+{
+    if (type == 'w')
+        self->wholes -= count;
+    else
+    if (type == 'r')
+        self->reals -= count;
+    else
+    if (type == 's')
+        self->strings -= count;
+    else
+        self->blobs -= count;
+}
+
+//  Census difference, from start to end
+
+static inline census_t
+s_census_range (census_t *start, census_t *end)
+{
+    census_t census = {
+        end->wholes - start->wholes,
+        end->reals - start->reals,
+        end->strings - start->strings,
+        end->blobs - start->blobs
+    };
+    return census;
+}
+
+//  Allocate a new string value, with an empty header, from the slab
+
+static char *
+s_string_new (zs_slab_t *slab, const char *string)
+{
+    size_t size = strlen (string) + 1;
+    string_header_t *header = (string_header_t *)
+        zs_slab_alloc (slab, sizeof (string_header_t) + size);
+    header->refs = 1;
+    header->numeric = 0;
+    memcpy (header + 1, string, size);
+    return (char *) (header + 1);
+}
+
+//  Return header for a string value, parsing the string if not already
+//  done. A string counts as whole if it reads the same as whole or real,
+//  else as real if it reads as real, else it's not a number, '-'.
+
+static string_header_t *
+s_string_parse (char *string)
+{
+    string_header_t *header = (string_header_t *) string - 1;
+    if (!header->numeric) {
+        errno = 0;
+        header->whole = (int64_t) strtoll (string, NULL, 10);
+        if (errno)
+            header->whole = 0;
+        char *end = string;
+        header->real = zs_strtod (string, &end);
+        if (end == string) {
+            header->real = 0;
+            header->numeric = '-';
+        }
+        else
+            header->numeric = (double) header->whole == header->real? 'w': 'r';
+    }
+    return header;
 }
 
 static void
-s_value_destroy (value_t **self_p)
+s_value_free (value_t *self)
 {
-    assert (self_p);
-    if (*self_p) {
-        value_t *self = *self_p;
-        free (self);
-        *self_p = NULL;
+    if (self->type == 's') {
+        string_header_t *header = (string_header_t *) self->string - 1;
+        if (header->refs && --header->refs == 0)
+            zs_slab_free (header);
     }
+    else
+    if (self->type == 'b' && --self->blob->refs == 0) {
+        if (self->blob->free_fn)
+            (self->blob->free_fn) ((void *) self->blob->data, self->blob->hint);
+        zs_slab_free (self->blob);
+    }
+    self->type = 0;
+}
+
+//  Take another reference to a value's string or blob, for a copy of the
+//  value; string constants need none
+
+static inline void
+s_value_share (value_t *self)
+{
+    if (self->type == 's') {
+        string_header_t *header = (string_header_t *) self->string - 1;
+        if (header->refs)
+            header->refs++;
+    }
+    else
+    if (self->type == 'b')
+        self->blob->refs++;
 }
 
 static const char *
 s_value_string (value_t *self, zs_pipe_t *pipe)
 {
     if (pipe) {
-        if (self->type == 'w') {
-            snprintf (pipe->string_value, sizeof (pipe->string_value),
-                      "%" PRId64, self->whole);
-            return pipe->string_value;
+        switch (self->type) {
+            case 'w':
+                s_format_whole (self->whole, pipe->string_value);
+                return pipe->string_value;
+            case 'r':
+                s_format_real (self->real, pipe->string_value);
+                return pipe->string_value;
+            case 's':
+                return self->string;
         }
-        else
-        if (self->type == 'r') {
-            snprintf (pipe->string_value, sizeof (pipe->string_value),
-                      "%.9g", self->real);
-            return pipe->string_value;
-        }
-        else
-        if (self->type == 's')
-            return self->string;
-        else
-        if (self->type == '|')
-            return "|";
     }
     return "";
 }
 
+//  Return value coerced to a whole number, or zero if not possible
+
+static int64_t
+s_value_whole (value_t *self)
+{
+    switch (self->type) {
+        case 'w':
+            return self->whole;
+        case 'r':
+            return self->real > 0?
+                (int64_t) (self->real + 0.5):
+                (int64_t) (self->real - 0.5);
+        case 's':
+            return s_string_parse (self->string)->whole;
+    }
+    return 0;
+}
+
+//  Return value coerced to a real number, or zero if not possible
+
+static double
+s_value_real (value_t *self)
+{
+    switch (self->type) {
+        case 'w':
+            return (double) self->whole;
+        case 'r':
+            return self->real;
+        case 's':
+            return s_string_parse (self->string)->real;
+    }
+    return 0;
+}
+
+//  Return value at given index from start of ring; caller must check that
+//  the index is less than the ring size.
+
+static inline value_t *
+s_value_at (zs_pipe_t *self, size_t index)
+{
+    return &self->values [(self->head + index) & (self->limit - 1)];
+}
+
+//  Map a new ring of the given size onto an unlinked temporary file. Returns
+//  NULL if that was not possible.
+
+static value_t *
+s_ring_map (size_t limit)
+{
+    value_t *values = NULL;
+#if defined (__UNIX__)
+    const char *tmpdir = getenv ("TMPDIR");
+    char *filename = zsys_sprintf ("%s/zs-pipe-XXXXXX", tmpdir? tmpdir: "/tmp");
+    int handle = mkstemp (filename);
+    if (handle != -1) {
+        //  The file goes away when we unmap it, or if we crash
+        unlink (filename);
+        size_t size = limit * sizeof (value_t);
+        if (ftruncate (handle, size) == 0) {
+            void *map = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, handle, 0);
+            if (map != MAP_FAILED)
+                values = (value_t *) map;
+        }
+        close (handle);
+    }
+    zstr_free (&filename);
+#endif
+    return values;
+}
+
+//  Allocate a new ring of the given size, past the spill threshold mapped
+//  to a file if possible, else on the heap, and set spilled to say which.
+
+static value_t *
+s_ring_new (zs_pipe_t *self, size_t limit, bool *spilled)
+{
+    value_t *values = NULL;
+    if (self->spill && limit > self->spill)
+        values = s_ring_map (limit);
+    *spilled = values != NULL;
+    if (!values) {
+        values = (value_t *) malloc (limit * sizeof (value_t));
+        assert (values);
+    }
+    return values;
+}
+
+//  Free a ring allocated by s_ring_new
+
+static void
+s_ring_free (value_t *values, size_t limit, bool spilled)
+{
+#if defined (__UNIX__)
+    if (spilled) {
+        munmap (values, limit * sizeof (value_t));
+        return;
+    }
+#endif
+    free (values);
+}
+
+//  Move the values to a new ring buffer of the given size, unwrapping them
+//  so they start at slot zero, and let go of the old ring.
+
+static void
+s_resize (zs_pipe_t *self, size_t limit)
+{
+    bool spilled;
+    value_t *values = s_ring_new (self, limit, &spilled);
+    if (self->size) {
+        size_t tail_size = self->limit - self->head;
+        if (tail_size > self->size)
+            tail_size = self->size;
+        memcpy (values, self->values + self->head, tail_size * sizeof (value_t));
+        memcpy (values + tail_size, self->values,
+                (self->size - tail_size) * sizeof (value_t));
+    }
+    if (self->share) {
+        //  Other pipes still use the old ring
+        (*self->share)--;
+        self->share = NULL;
+    }
+    else
+        s_ring_free (self->values, self->limit, self->spilled);
+    self->values = values;
+    self->limit = limit;
+    self->spilled = spilled;
+    self->head = 0;
+}
+
+//  Grow the ring buffer, doubling its size until it can hold the wanted
+//  number of values. We allocate the ring lazily, on the first send.
+
+static void
+s_grow (zs_pipe_t *self, size_t wanted)
+{
+    size_t limit = self->limit? self->limit * 2: PIPE_LIMIT;
+    while (limit < wanted)
+        limit *= 2;
+    s_resize (self, limit);
+}
+
+//  Take our own copy of a shared ring, before we write to it. If the other
+//  pipes have let go of the ring, it's ours and we don't need to copy it.
+
+static void
+s_unshare (zs_pipe_t *self)
+{
+    if (*self->share == 1) {
+        free (self->share);
+        self->share = NULL;
+    }
+    else
+        s_resize (self, self->limit);
+}
+
+//  Let go of a shared ring, freeing it if we're the last pipe to use it.
+//  This leaves the pipe with no ring.
+
+static void
+s_release (zs_pipe_t *self)
+{
+    if (--*self->share == 0) {
+        free (self->share);
+        s_ring_free (self->values, self->limit, self->spilled);
+    }
+    self->share = NULL;
+    self->values = NULL;
+    self->limit = 0;
+    self->spilled = false;
+}
+
+//  Append a slot to the end of the ring, and return it for the caller
+//  to fill in.
+
+static inline value_t *
+s_push_back (zs_pipe_t *self)
+{
+    if (self->share)
+        s_unshare (self);
+    if (self->size == self->limit)
+        s_grow (self, self->size + 1);
+    return s_value_at (self, self->size++);
+}
+
+//  Insert a slot at the start of the ring, and return it for the caller
+//  to fill in.
+
+static inline value_t *
+s_push_front (zs_pipe_t *self)
+{
+    if (self->share)
+        s_unshare (self);
+    if (self->size == self->limit)
+        s_grow (self, self->size + 1);
+    self->head = (self->head - 1) & (self->limit - 1);
+    self->size++;
+    self->base--;
+    return &self->values [self->head];
+}
+
+//  Return number of marks in the pipe
+
+static inline size_t
+s_marks (zs_pipe_t *self)
+{
+    return self->marks_tail - self->marks_head;
+}
+
+//  Return offset of mark from the first value in the ring, where 0 means
+//  the mark comes before the first value, and size means it comes after
+//  the last value. Index counts back from the end of the mark index, so
+//  the last mark is 1.
+
+static inline size_t
+s_mark_offset (zs_pipe_t *self, size_t index)
+{
+    return self->marks [self->marks_tail - index].position - self->base;
+}
+
+//  Return true if the last item in the pipe is a mark rather than a value
+
+static inline bool
+s_ends_with_mark (zs_pipe_t *self)
+{
+    return s_marks (self) && s_mark_offset (self, 1) == self->size;
+}
+
+//  Append a mark at the end of the pipe
+
+static void
+s_mark_push (zs_pipe_t *self)
+{
+    if (self->marks_tail == self->marks_limit) {
+        if (self->marks_head) {
+            //  Reclaim entries we've dropped from the front
+            memmove (self->marks, self->marks + self->marks_head,
+                     s_marks (self) * sizeof (mark_t));
+            self->marks_tail -= self->marks_head;
+            self->marks_head = 0;
+        }
+        else {
+            self->marks_limit = self->marks_limit? self->marks_limit * 2: MARKS_LIMIT;
+            self->marks = (mark_t *) realloc (self->marks,
+                                              self->marks_limit * sizeof (mark_t));
+            assert (self->marks);
+        }
+    }
+    mark_t *mark = &self->marks [self->marks_tail++];
+    mark->position = self->base + self->size;
+    mark->census = self->sent;
+}
+
+//  Drop marks that come before the first value in the ring
+
+static inline void
+s_marks_trim_front (zs_pipe_t *self)
+{
+    while (s_marks (self) && self->marks [self->marks_head].position == self->base)
+        self->marks_head++;
+    if (self->marks_head == self->marks_tail)
+        self->marks_head = self->marks_tail = 0;
+}
+
+//  Drop count values off the head of the ring, after the caller has taken
+//  them, and any marks before the new first value. The caller accounts for
+//  the census.
+
+static void
+s_drop_front (zs_pipe_t *self, size_t count)
+{
+    self->head = (self->head + count) & (self->limit - 1);
+    self->size -= count;
+    self->base += count;
+    while (s_marks (self) && self->marks [self->marks_head].position < self->base)
+        self->marks_head++;
+}
+
+//  Return census of the first phrase in the pipe, that is, the values up to
+//  the first mark after the first value, and set length to its size. Block
+//  receives use this to skip coercion on phrases of a single type.
+
+static census_t
+s_census_first_phrase (zs_pipe_t *self, size_t *length)
+{
+    size_t mark = self->marks_head;
+    while (mark < self->marks_tail && self->marks [mark].position <= self->base)
+        mark++;
+    if (mark < self->marks_tail) {
+        *length = self->marks [mark].position - self->base;
+        return s_census_range (&self->taken, &self->marks [mark].census);
+    }
+    *length = self->size;
+    return s_census_range (&self->taken, &self->sent);
+}
+
 //  ---------------------------------------------------------------------------
 //  Create a new zs_pipe, return the reference if successful, or NULL
 //  if construction failed due to lack of available memory.
@@ -88,10 +579,6 @@ zs_pipe_t *
 zs_pipe_new (void)
 {
     zs_pipe_t *self = (zs_pipe_t *) zmalloc (sizeof (zs_pipe_t));
-    if (self) {
-        self->values = zlistx_new ();
-        zlistx_set_destructor (self->values, (czmq_destructor *) s_value_destroy);
-    }
     return self;
 }
 
@@ -102,66 +589,393 @@ zs_pipe_new (void)
 void
 zs_pipe_destroy (zs_pipe_t **self_p)
 {
-    assert (self_p);
-    if (*self_p) {
-        zs_pipe_t *self = *self_p;
-        zlistx_destroy (&self->values);
-        s_value_destroy (&self->value);
-        free (self);
-        *self_p = NULL;
+    assert (self_p);
+    if (*self_p) {
+        zs_pipe_t *self = *self_p;
+        zs_pipe_purge (self);
+        s_value_free (&self->value);
+        s_ring_free (self->values, self->limit, self->spilled);
+        free (self->marks);
+        free (self);
+        *self_p = NULL;
+    }
+}
+
+
+//  ---------------------------------------------------------------------------
+//  Allocate string values from the given slab, instead of the heap. Strings
+//  already in the pipe are not affected. The slab must outlive any strings
+//  allocated from it.
+
+void
+zs_pipe_set_slab (zs_pipe_t *self, zs_slab_t *slab)
+{
+    self->slab = slab;
+}
+
+
+//  ---------------------------------------------------------------------------
+//  Keep the ring buffer in a memory-mapped temporary file, rather than on
+//  the heap, once it grows past threshold values; 0 means never, which is
+//  the default. The kernel can then page older values out to disk, so a
+//  pipe can hold more values than fit in memory. String values stay in
+//  memory. Takes effect the next time the ring grows.
+
+void
+zs_pipe_set_spill (zs_pipe_t *self, size_t threshold)
+{
+    self->spill = threshold;
+}
+
+
+//  ---------------------------------------------------------------------------
+//  Set a capacity on the pipe, in values, or 0 for no limit, which is the
+//  default. Sends always succeed, so a pipe can go over its capacity; a
+//  producer checks zs_pipe_full to know when to yield, and a cross-thread
+//  pipe stops consuming into a full pipe.
+
+void
+zs_pipe_set_capacity (zs_pipe_t *self, size_t capacity)
+{
+    self->capacity = capacity;
+}
+
+
+//  ---------------------------------------------------------------------------
+//  Returns true if the pipe has a capacity and holds at least that many
+//  values. Returns false otherwise.
+
+bool
+zs_pipe_full (zs_pipe_t *self)
+{
+    return self->capacity && self->size >= self->capacity;
+}
+
+
+//  ---------------------------------------------------------------------------
+//  Send whole number to pipe; this wipes the current pipe register.
+
+void
+zs_pipe_send_whole (zs_pipe_t *self, int64_t whole)
+{
+    value_t *value = s_push_back (self);
+    value->type = 'w';
+    value->whole = whole;
+    self->sent.wholes++;
+}
+
+
+//  ---------------------------------------------------------------------------
+//  Send real number to pipe; this wipes the current pipe register.
+
+void
+zs_pipe_send_real (zs_pipe_t *self, double real)
+{
+    value_t *value = s_push_back (self);
+    value->type = 'r';
+    value->real = real;
+    self->sent.reals++;
+}
+
+
+//  ---------------------------------------------------------------------------
+//  Send string to pipe; this wipes the current pipe register.
+
+void
+zs_pipe_send_string (zs_pipe_t *self, const char *string)
+{
+    value_t *value = s_push_back (self);
+    value->type = 's';
+    value->string = s_string_new (self->slab, string);
+    self->sent.strings++;
+}
+
+
+//  ---------------------------------------------------------------------------
+//  Send a blob of binary data to pipe, without copying it. Blobs move from
+//  pipe to pipe by reference. When the last value holding the blob goes,
+//  the pipe calls free_fn, if not NULL, with the data and hint. This wipes
+//  the current pipe register.
+
+void
+zs_pipe_send_blob (zs_pipe_t *self, const void *data, size_t size,
+                   zs_pipe_blob_free_fn *free_fn, void *hint)
+{
+    blob_t *blob = (blob_t *) zs_slab_alloc (self->slab, sizeof (blob_t));
+    blob->refs = 1;
+    blob->data = (const byte *) data;
+    blob->size = size;
+    blob->free_fn = free_fn;
+    blob->hint = hint;
+    value_t *value = s_push_back (self);
+    value->type = 'b';
+    value->blob = blob;
+    self->sent.blobs++;
+}
+
+
+//  ---------------------------------------------------------------------------
+//  Send a chunk to pipe as a blob, without copying it. Takes ownership of
+//  the chunk, and destroys it when the last value holding the blob goes.
+//  Nullifies the caller's reference.
+
+static void
+s_chunk_free (void *data, void *hint)
+{
+    zchunk_t *chunk = (zchunk_t *) hint;
+    zchunk_destroy (&chunk);
+}
+
+void
+zs_pipe_send_chunk (zs_pipe_t *self, zchunk_t **chunk_p)
+{
+    assert (chunk_p && *chunk_p);
+    zchunk_t *chunk = *chunk_p;
+    zs_pipe_send_blob (self, zchunk_data (chunk), zchunk_size (chunk), s_chunk_free, chunk);
+    *chunk_p = NULL;
+}
+
+
+//  ---------------------------------------------------------------------------
+//  Send the source pipe's register value to the pipe. Strings and blobs are
+//  shared rather than copied, so this is how a function forwards a value
+//  it received. Does nothing if the source register is empty.
+
+void
+zs_pipe_forward (zs_pipe_t *self, zs_pipe_t *source)
+{
+    if (source->value.type) {
+        value_t *value = s_push_back (self);
+        *value = source->value;
+        s_value_share (value);
+        s_census_add (&self->sent, value->type, 1);
+    }
+}
+
+
+//  ---------------------------------------------------------------------------
+//  Returns the number of bytes needed to hold a string constant of the given
+//  length, including the terminating null, for zs_pipe_constant_new.
+
+size_t
+zs_pipe_constant_size (size_t length)
+{
+    return sizeof (string_header_t) + length + 1;
+}
+
+
+//  ---------------------------------------------------------------------------
+//  Build a string constant in the caller's buffer, which must be aligned to
+//  8 bytes and have room for zs_pipe_constant_size bytes. The string need
+//  not be null-terminated. Returns the constant, for zs_pipe_send_constant.
+
+const char *
+zs_pipe_constant_new (void *buffer, const char *string, size_t length)
+{
+    string_header_t *header = (string_header_t *) buffer;
+    header->refs = 0;
+    header->numeric = 0;
+    char *constant = (char *) (header + 1);
+    memcpy (constant, string, length);
+    constant [length] = 0;
+    return constant;
+}
+
+
+//  ---------------------------------------------------------------------------
+//  Send a string constant to pipe, without copying it: the pipe borrows the
+//  constant. The caller must keep the constant unchanged as long as any
+//  pipe may hold it, or call zs_pipe_materialize first. This wipes the
+//  current pipe register.
+
+void
+zs_pipe_send_constant (zs_pipe_t *self, const char *constant)
+{
+    value_t *value = s_push_back (self);
+    value->type = 's';
+    value->string = (char *) constant;
+    self->sent.strings++;
+}
+
+
+//  ---------------------------------------------------------------------------
+//  Give the pipe its own copy of any string constants it borrowed, so they
+//  outlive the memory they were borrowed from.
+
+void
+zs_pipe_materialize (zs_pipe_t *self)
+{
+    if (self->value.type == 's'
+    && ((string_header_t *) self->value.string - 1)->refs == 0)
+        self->value.string = s_string_new (self->slab, self->value.string);
+
+    if (self->sent.strings != self->taken.strings) {
+        size_t index;
+        for (index = 0; index < self->size; index++) {
+            value_t *value = s_value_at (self, index);
+            if (value->type == 's'
+            && ((string_header_t *) value->string - 1)->refs == 0) {
+                if (self->share) {
+                    s_unshare (self);
+                    value = s_value_at (self, index);
+                }
+                value->string = s_string_new (self->slab, value->string);
+            }
+        }
+    }
+}
+
+
+//  ---------------------------------------------------------------------------
+//  Send an array of whole numbers to pipe, in order.
+
+void
+zs_pipe_send_wholes (zs_pipe_t *self, const int64_t *wholes, size_t count)
+{
+    if (self->share)
+        s_unshare (self);
+    if (self->size + count > self->limit)
+        s_grow (self, self->size + count);
+    size_t index;
+    for (index = 0; index < count; index++) {
+        value_t *value = s_value_at (self, self->size + index);
+        value->type = 'w';
+        value->whole = wholes [index];
+    }
+    self->size += count;
+    self->sent.wholes += count;
+}
+
+
+//  ---------------------------------------------------------------------------
+//  Send an array of real numbers to pipe, in order.
+
+void
+zs_pipe_send_reals (zs_pipe_t *self, const double *reals, size_t count)
+{
+    if (self->share)
+        s_unshare (self);
+    if (self->size + count > self->limit)
+        s_grow (self, self->size + count);
+    size_t index;
+    for (index = 0; index < count; index++) {
+        value_t *value = s_value_at (self, self->size + index);
+        value->type = 'r';
+        value->real = reals [index];
+    }
+    self->size += count;
+    self->sent.reals += count;
+}
+
+
+//  ---------------------------------------------------------------------------
+//  Returns true if the pipe contains at least one real number. Returns false
+//  otherwise.
+
+bool
+zs_pipe_realish (zs_pipe_t *self)
+{
+    return self->sent.reals != self->taken.reals;
+}
+
+
+//  ---------------------------------------------------------------------------
+//  Returns the number of values in the pipe, not counting marks.
+
+size_t
+zs_pipe_size (zs_pipe_t *self)
+{
+    return self->size;
+}
+
+
+//  ---------------------------------------------------------------------------
+//  Returns the number of values of the given type in the pipe, where type is
+//  'w' for whole, 'r' for real, 's' for string, or 'b' for blob; or the
+//  number of phrase marks if type is 'm'. As pulls move type counts along
+//  with values, an atomic can use this to pick a kernel for exactly the
+//  values it gets.
+
+size_t
+zs_pipe_count (zs_pipe_t *self, char type)
+{
+    switch (type) {
+        case 'm':
+            return s_marks (self);
+        case 'w':
+            return self->sent.wholes - self->taken.wholes;
+        case 'r':
+            return self->sent.reals - self->taken.reals;
+        case 's':
+            return self->sent.strings - self->taken.strings;
+        case 'b':
+            return self->sent.blobs - self->taken.blobs;
     }
+    return 0;
 }
 
 
 //  ---------------------------------------------------------------------------
-//  Send whole number to pipe; this wipes the current pipe register.
+//  If the next item in the pipe is a phrase mark, rather than a value, takes
+//  it off the pipe and returns true. Otherwise returns false. Use this with
+//  zs_pipe_recv to copy values and marks out of the pipe in order.
 
-void
-zs_pipe_send_whole (zs_pipe_t *self, int64_t whole)
+bool
+zs_pipe_recv_mark (zs_pipe_t *self)
 {
-    value_t *value = s_value_new (NULL);
-    value->type = 'w';
-    value->whole = whole;
-    zlistx_add_end (self->values, value);
+    if (s_marks (self) && self->marks [self->marks_head].position == self->base) {
+        self->marks_head++;
+        if (self->marks_head == self->marks_tail)
+            self->marks_head = self->marks_tail = 0;
+        return true;
+    }
+    return false;
 }
 
 
-//  ---------------------------------------------------------------------------
-//  Send real number to pipe; this wipes the current pipe register.
+//  Load a copy of the value at the cursor into the register, taking a
+//  reference to any string, so the register owns its value as usual
 
-void
-zs_pipe_send_real (zs_pipe_t *self, double real)
+static bool
+s_peek (zs_pipe_t *self)
 {
-    value_t *value = s_value_new (NULL);
-    value->type = 'r';
-    value->real = real;
-    zlistx_add_end (self->values, value);
-    self->nbr_reals++;
+    s_value_free (&self->value);
+    if (self->cursor < self->size) {
+        self->value = *s_value_at (self, self->cursor);
+        s_value_share (&self->value);
+        return true;
+    }
+    return false;
 }
 
 
 //  ---------------------------------------------------------------------------
-//  Send string to pipe; this wipes the current pipe register.
+//  Loads the first value in the pipe into the register, without taking it
+//  off the pipe, and sets the pipe's cursor there. Returns true if there
+//  was a value, else false. Read the value with zs_pipe_type, zs_pipe_whole,
+//  and so on. Together with zs_pipe_next, this lets a function make several
+//  passes over its input without copying it. The cursor is valid until the
+//  pipe next changes.
 
-void
-zs_pipe_send_string (zs_pipe_t *self, const char *string)
+bool
+zs_pipe_first (zs_pipe_t *self)
 {
-    value_t *value = s_value_new (string);
-    value->type = 's';
-    value->string = &value->type + 1;
-    strcpy (value->string, string);
-    zlistx_add_end (self->values, value);
+    self->cursor = 0;
+    return s_peek (self);
 }
 
 
 //  ---------------------------------------------------------------------------
-//  Returns true if the pipe contains at least one real number. Returns false
-//  otherwise.
+//  Moves the pipe's cursor to the next value and loads it into the register,
+//  without taking it off the pipe. Returns true if there was a value, else
+//  false when the cursor has passed the last value.
 
 bool
-zs_pipe_realish (zs_pipe_t *self)
+zs_pipe_next (zs_pipe_t *self)
 {
-    return (self->nbr_reals > 0);
+    if (self->cursor < self->size)
+        self->cursor++;
+    return s_peek (self);
 }
 
 
@@ -174,30 +988,73 @@ zs_pipe_realish (zs_pipe_t *self)
 bool
 zs_pipe_recv (zs_pipe_t *self)
 {
-    //  Skip any marks
-    while (true) {
-        s_value_destroy (&self->value);
-        self->value = (value_t *) zlistx_detach (self->values, NULL);
-        if (!self->value)
-            return false;       //  Pipe is empty
-        else
-        if (isalpha (self->value->type)) {
-            if (self->value->type == 'r')
-                self->nbr_reals--;
-            return true;        //  We had a normal value
-        }
+    s_value_free (&self->value);
+    if (self->size) {
+        //  Skip any marks
+        s_marks_trim_front (self);
+        self->value = self->values [self->head];
+        self->head = (self->head + 1) & (self->limit - 1);
+        self->size--;
+        self->base++;
+        s_census_add (&self->taken, self->value.type, 1);
+        return true;            //  We had a normal value
     }
+    //  Pipe is empty, so drop any trailing marks
+    self->marks_head = self->marks_tail = 0;
+    return false;
 }
 
 
 //  ---------------------------------------------------------------------------
-//  Returns the type of the register, 'w' for whole, 'r' for real, or 's' for
-//  string. Returns -1 if the register is empty.
+//  Returns the type of the register, 'w' for whole, 'r' for real, 's' for
+//  string, or 'b' for blob. Returns -1 if the register is empty.
 
 char
 zs_pipe_type (zs_pipe_t *self)
 {
-    return self->value? self->value->type: -1;
+    return self->value.type? self->value.type: -1;
+}
+
+
+//  ---------------------------------------------------------------------------
+//  Returns the numeric type of the register: 'w' for a whole, or a string
+//  that reads as a whole; 'r' for a real, or a string that reads as a real;
+//  '-' for a string that is not a number, or a blob. Returns -1 if the
+//  register is empty. Strings are parsed once, and the result is kept with
+//  the string.
+
+char
+zs_pipe_numeric (zs_pipe_t *self)
+{
+    if (self->value.type == 's')
+        return s_string_parse (self->value.string)->numeric;
+    else
+    if (self->value.type == 'b')
+        return '-';
+    else
+        return zs_pipe_type (self);
+}
+
+
+//  ---------------------------------------------------------------------------
+//  Returns the data of the blob in the register, or NULL if the register
+//  does not hold a blob. The caller must not modify or free the data.
+
+const byte *
+zs_pipe_blob (zs_pipe_t *self)
+{
+    return self->value.type == 'b'? self->value.blob->data: NULL;
+}
+
+
+//  ---------------------------------------------------------------------------
+//  Returns the size of the blob in the register, or zero if the register
+//  does not hold a blob.
+
+size_t
+zs_pipe_blob_size (zs_pipe_t *self)
+{
+    return self->value.type == 'b'? self->value.blob->size: 0;
 }
 
 
@@ -209,22 +1066,7 @@ zs_pipe_type (zs_pipe_t *self)
 int64_t
 zs_pipe_whole (zs_pipe_t *self)
 {
-    if (self->value) {
-        if (self->value->type == 'w')
-            return self->value->whole;
-        else
-        if (self->value->type == 'r')
-            return self->value->real > 0?
-                (int64_t) (self->value->real + 0.5):
-                (int64_t) (self->value->real - 0.5);
-        else
-        if (self->value->type == 's') {
-            errno = 0;
-            int64_t whole = (int64_t) strtoll (self->value->string, NULL, 10);
-            return errno == 0? whole: 0;
-        }
-    }
-    return 0;
+    return s_value_whole (&self->value);
 }
 
 
@@ -236,32 +1078,19 @@ zs_pipe_whole (zs_pipe_t *self)
 double
 zs_pipe_real (zs_pipe_t *self)
 {
-    if (self->value) {
-        if (self->value->type == 'w')
-            return (double) self->value->whole;
-        else
-        if (self->value->type == 'r')
-            return self->value->real;
-        else
-        if (self->value->type == 's') {
-            char *end = self->value->string;
-            double real = zs_strtod (self->value->string, &end);
-            return end > self->value->string? real: 0;
-        }
-    }
-    return 0;
+    return s_value_real (&self->value);
 }
 
 
 //  ---------------------------------------------------------------------------
 //  Returns the value of the register, coerced to a string if needed. If the
-//  register is empty, returns an empty string "". The caller must not modify
-//  or free the string.
+//  register is empty, or holds a blob, returns an empty string "". The
+//  caller must not modify or free the string.
 
 const char *
 zs_pipe_string (zs_pipe_t *self)
 {
-    return s_value_string (self->value, self);
+    return s_value_string (&self->value, self);
 }
 
 
@@ -308,6 +1137,84 @@ zs_pipe_recv_string (zs_pipe_t *self)
 }
 
 
+//  ---------------------------------------------------------------------------
+//  Receives up to limit values off the pipe into the caller's array, coercing
+//  them to wholes if needed. Returns the number of values received, or zero
+//  if the pipe is empty. Skips marks, like zs_pipe_recv, and leaves the
+//  register empty.
+
+size_t
+zs_pipe_recv_wholes (zs_pipe_t *self, int64_t *wholes, size_t limit)
+{
+    s_value_free (&self->value);
+    if (self->size == 0) {
+        self->marks_head = self->marks_tail = 0;
+        return 0;
+    }
+    size_t count = self->size < limit? self->size: limit;
+    size_t index;
+    size_t length;
+    census_t census = s_census_first_phrase (self, &length);
+    if (census.wholes == length) {
+        //  First phrase holds only wholes, so no coercion is needed
+        if (count > length)
+            count = length;
+        for (index = 0; index < count; index++)
+            wholes [index] = s_value_at (self, index)->whole;
+        self->taken.wholes += count;
+    }
+    else
+        for (index = 0; index < count; index++) {
+            //  Work on a copy, as the ring may be shared
+            value_t value = *s_value_at (self, index);
+            wholes [index] = s_value_whole (&value);
+            s_census_add (&self->taken, value.type, 1);
+            s_value_free (&value);
+        }
+    s_drop_front (self, count);
+    return count;
+}
+
+
+//  ---------------------------------------------------------------------------
+//  Receives up to limit values off the pipe into the caller's array, coercing
+//  them to reals if needed. Returns the number of values received, or zero
+//  if the pipe is empty. Skips marks, like zs_pipe_recv, and leaves the
+//  register empty.
+
+size_t
+zs_pipe_recv_reals (zs_pipe_t *self, double *reals, size_t limit)
+{
+    s_value_free (&self->value);
+    if (self->size == 0) {
+        self->marks_head = self->marks_tail = 0;
+        return 0;
+    }
+    size_t count = self->size < limit? self->size: limit;
+    size_t index;
+    size_t length;
+    census_t census = s_census_first_phrase (self, &length);
+    if (census.reals == length) {
+        //  First phrase holds only reals, so no coercion is needed
+        if (count > length)
+            count = length;
+        for (index = 0; index < count; index++)
+            reals [index] = s_value_at (self, index)->real;
+        self->taken.reals += count;
+    }
+    else
+        for (index = 0; index < count; index++) {
+            //  Work on a copy, as the ring may be shared
+            value_t value = *s_value_at (self, index);
+            reals [index] = s_value_real (&value);
+            s_census_add (&self->taken, value.type, 1);
+            s_value_free (&value);
+        }
+    s_drop_front (self, count);
+    return count;
+}
+
+
 //  ---------------------------------------------------------------------------
 //  Marks an end of phrase in the pipe. This is used to delimit the pipe
 //  as input for later function calls. Marks are ignored when receiving
@@ -316,33 +1223,120 @@ zs_pipe_recv_string (zs_pipe_t *self)
 void
 zs_pipe_mark (zs_pipe_t *self)
 {
-    value_t *value = s_value_new (NULL);
-    value->type = '|';          //  Non-alphabetic
-    zlistx_add_end (self->values, value);
+    s_mark_push (self);
 }
 
+//  Splice values from index onwards, to end of source pipe, onto the end
+//  of the pipe. The census is for values in the source before the index.
+//  We copy the range in at most three runs, as either ring may wrap. The
+//  caller drops any marks in this range.
+
 static void
-s_pull_values (zs_pipe_t *self, zs_pipe_t *source)
-{
-    //  Pull values from cursor onwards
-    while (true) {
-        value_t *value = (value_t *) zlistx_detach_cur (source->values);
-        if (!value)
-            break;
-        if (isalpha (value->type)) {
-            zlistx_add_end (self->values, value);
-            if (value->type == 'r') {
-                source->nbr_reals--;
-                self->nbr_reals++;
-            }
-        }
-        else
-            s_value_destroy (&value);
+s_splice (zs_pipe_t *self, zs_pipe_t *source, size_t index, census_t census)
+{
+    size_t count = source->size - index;
+    if (self->share)
+        s_unshare (self);
+    if (self->size + count > self->limit)
+        s_grow (self, self->size + count);
+
+    size_t from = (source->head + index) & (source->limit - 1);
+    size_t to = (self->head + self->size) & (self->limit - 1);
+    while (count) {
+        size_t run = count;
+        if (run > source->limit - from)
+            run = source->limit - from;
+        if (run > self->limit - to)
+            run = self->limit - to;
+        memcpy (self->values + to, source->values + from, run * sizeof (value_t));
+        from = (from + run) & (source->limit - 1);
+        to = (to + run) & (self->limit - 1);
+        count -= run;
+    }
+    self->size += source->size - index;
+    source->size = index;
+
+    //  Move type counts along with the values
+    census_t moved = s_census_range (&census, &source->sent);
+    self->sent.wholes += moved.wholes;
+    self->sent.reals += moved.reals;
+    self->sent.strings += moved.strings;
+    self->sent.blobs += moved.blobs;
+    source->sent = census;
+}
+
+//  Splice the last value from the source pipe onto the end of the pipe
+
+static void
+s_splice_last (zs_pipe_t *self, zs_pipe_t *source)
+{
+    value_t *value = s_value_at (source, --source->size);
+    *s_push_back (self) = *value;
+    s_census_sub (&source->sent, value->type, 1);
+    s_census_add (&self->sent, value->type, 1);
+}
+
+//  Splice from the last mark to the end of the source pipe, onto the end
+//  of the pipe, and drop the mark
+
+static void
+s_splice_phrase (zs_pipe_t *self, zs_pipe_t *source)
+{
+    mark_t *mark = &source->marks [--source->marks_tail];
+    s_splice (self, source, mark->position - source->base, mark->census);
+}
+
+
+//  ---------------------------------------------------------------------------
+//  Make the pipe a copy of the source pipe, values and marks, without copying
+//  the values: the two pipes share the source's ring until either of them
+//  next sends or pulls values into it. This lets several functions each
+//  take the same phrase. Any values already in the pipe are purged.
 
-        value = (value_t *) zlistx_next (source->values);
-        if (!value)
-            break;
+void
+zs_pipe_tee (zs_pipe_t *self, zs_pipe_t *source)
+{
+    zs_pipe_purge (self);
+    s_ring_free (self->values, self->limit, self->spilled);
+    self->values = NULL;
+    self->limit = 0;
+    self->spilled = false;
+    if (source->values) {
+        if (!source->share) {
+            source->share = (size_t *) malloc (sizeof (size_t));
+            assert (source->share);
+            *source->share = 1;
+        }
+        (*source->share)++;
+        self->share = source->share;
+        self->values = source->values;
+        self->limit = source->limit;
+        self->spilled = source->spilled;
     }
+    self->head = source->head;
+    self->size = source->size;
+    self->base = source->base;
+    self->sent = source->sent;
+    self->taken = source->taken;
+
+    //  Take our own reference to each string and blob
+    if (self->sent.strings != self->taken.strings
+    ||  self->sent.blobs != self->taken.blobs) {
+        size_t index;
+        for (index = 0; index < self->size; index++)
+            s_value_share (s_value_at (self, index));
+    }
+    //  Copy the marks
+    size_t marks = s_marks (source);
+    if (marks > self->marks_limit) {
+        free (self->marks);
+        self->marks_limit = source->marks_limit;
+        self->marks = (mark_t *) malloc (self->marks_limit * sizeof (mark_t));
+        assert (self->marks);
+    }
+    if (marks)
+        memcpy (self->marks, source->marks + source->marks_head, marks * sizeof (mark_t));
+    self->marks_tail = marks;
 }
 
 
@@ -353,15 +1347,8 @@ s_pull_values (zs_pipe_t *self, zs_pipe_t *source)
 void
 zs_pipe_pull_single (zs_pipe_t *self, zs_pipe_t *source)
 {
-    value_t *value = (value_t *) zlistx_last (source->values);
-    if (value && value->type != '|') {
-        zlistx_detach_cur (source->values);
-        zlistx_add_end (self->values, value);
-        if (value->type == 'r') {
-            source->nbr_reals--;
-            self->nbr_reals++;
-        }
-    }
+    if (source->size && !s_ends_with_mark (source))
+        s_splice_last (self, source);
     else
         zs_pipe_send_whole (self, 1);
 }
@@ -376,27 +1363,24 @@ zs_pipe_pull_single (zs_pipe_t *self, zs_pipe_t *source)
 void
 zs_pipe_pull_modest (zs_pipe_t *self, zs_pipe_t *source)
 {
-    value_t *value = (value_t *) zlistx_last (source->values);
-    if (value) {
-        if (value->type == '|') {
-            //  Pull last phrase; skip back until we hit the start of the
-            //  pipe or a mark (before the current mark)
-            value = (value_t *) zlistx_prev (source->values);
-            while (value && value->type != '|')
-                value = (value_t *) zlistx_prev (source->values);
+    if (s_ends_with_mark (source)) {
+        //  Pull last phrase, which runs from the previous mark, if any, up
+        //  to the final mark; we drop the final mark
+        source->marks_tail--;
+        if (s_marks (source)) {
+            mark_t *mark = &source->marks [source->marks_tail - 1];
+            s_splice (self, source, mark->position - source->base, mark->census);
         }
-        //  Ensure cursor points to first valid value, if any
-        if (!value)
-            zlistx_first (source->values);
         else
-        if (value->type == '|')
-            zlistx_next (source->values);
-
-        s_pull_values (self, source);
+            s_splice (self, source, 0, source->taken);
     }
+    else
+    if (source->size)
+        s_splice_last (self, source);
+
     //  Push a constant 1 if the input is empty; a modest function always
     //  gets at least one input value
-    if (zlistx_size (self->values) == 0)
+    if (self->size == 0 && s_marks (self) == 0)
         zs_pipe_send_whole (self, 1);
 }
 
@@ -409,23 +1393,17 @@ zs_pipe_pull_modest (zs_pipe_t *self, zs_pipe_t *source)
 void
 zs_pipe_pull_greedy (zs_pipe_t *self, zs_pipe_t *source)
 {
-    value_t *value = (value_t *) zlistx_last (source->values);
-    if (!value)
-        return;                 //  Nothing to do
-    if (value->type == '|')
+    if (s_ends_with_mark (source)) {
         //  Pull entire sentence
-        value = (value_t *) zlistx_first (source->values);
-    else {
-        //  Pull current phrase; skip back until we hit the start of
-        //  pipe or a mark
-        while (value && value->type != '|')
-            value = (value_t *) zlistx_prev (source->values);
+        source->marks_head = source->marks_tail = 0;
+        s_splice (self, source, 0, source->taken);
     }
-    //  Ensure cursor points to first valid value, if any
-    if (!value)
-        zlistx_first (source->values);
-
-    s_pull_values (self, source);
+    else
+    if (s_marks (source))
+        //  Pull current phrase, and the mark that starts it
+        s_splice_phrase (self, source);
+    else
+        s_splice (self, source, 0, source->taken);
 }
 
 
@@ -437,26 +1415,160 @@ zs_pipe_pull_greedy (zs_pipe_t *self, zs_pipe_t *source)
 void
 zs_pipe_pull_array (zs_pipe_t *self, zs_pipe_t *source)
 {
-    value_t *value = (value_t *) zlistx_last (source->values);
-    if (!value || value->type == '|')
+    if (source->size == 0 || s_ends_with_mark (source))
         return;             //  Invalid, do nothing
 
     //  Move last value to input; this will be first provided to function
-    zlistx_detach_cur (source->values);
-    zlistx_add_start (self->values, value);
-    if (value->type == 'r') {
-        source->nbr_reals--;
-        self->nbr_reals++;
+    value_t *value = s_value_at (source, --source->size);
+    *s_push_front (self) = *value;
+    s_census_sub (&source->sent, value->type, 1);
+    s_census_sub (&self->taken, value->type, 1);
+
+    //  A mark just before the value we moved does not count as a phrase
+    //  start; drop it and look for the one before
+    if (s_ends_with_mark (source))
+        source->marks_tail--;
+
+    //  Pull from start of this or previous phrase, and drop its mark
+    if (s_marks (source))
+        s_splice_phrase (self, source);
+    else
+        s_splice (self, source, 0, source->taken);
+}
+
+
+//  This holds the state of a paste in progress; we format values into the
+//  buffer and pass it to the writer each time it fills up
+
+typedef struct {
+    zs_pipe_writer_fn *writer;  //  Caller's writer function
+    void *args;                 //  Writer's arguments
+    size_t size;                //  Bytes held in buffer
+    int64_t total;              //  Bytes passed to writer so far
+    int rc;                     //  Set to -1 if writer failed
+    char buffer [PASTE_BUFFER];
+} paste_t;
+
+static void
+s_paste_flush (paste_t *self)
+{
+    if (self->size && self->rc == 0) {
+        self->rc = self->writer (self->args, self->buffer, self->size);
+        self->total += self->size;
     }
-    //  Skip to start of this or previous phrase
-    while (value && value->type != '|')
-        value = (value_t *) zlistx_prev (source->values);
+    self->size = 0;
+}
+
+//  Return space for size bytes at end of the buffer, flushing it first if
+//  needed; size must not be more than PASTE_BUFFER.
+
+static char *
+s_paste_reserve (paste_t *self, size_t size)
+{
+    if (self->size + size > PASTE_BUFFER)
+        s_paste_flush (self);
+    return self->buffer + self->size;
+}
+
+static void
+s_paste_bytes (paste_t *self, const char *data, size_t size)
+{
+    if (size > PASTE_BUFFER / 2) {
+        //  Pass long strings and blobs straight to the writer
+        s_paste_flush (self);
+        if (self->rc == 0) {
+            self->rc = self->writer (self->args, data, size);
+            self->total += size;
+        }
+    }
+    else {
+        memcpy (s_paste_reserve (self, size), data, size);
+        self->size += size;
+    }
+}
+
+static void
+s_paste_value (paste_t *self, value_t *value)
+{
+    if (value->type == 'w')
+        self->size += s_format_whole (value->whole, s_paste_reserve (self, FORMAT_MAX));
+    else
+    if (value->type == 'r')
+        self->size += s_format_real (value->real, s_paste_reserve (self, FORMAT_MAX));
+    else
+    if (value->type == 's')
+        s_paste_bytes (self, value->string, strlen (value->string));
+    else
+        s_paste_bytes (self, (const char *) value->blob->data, value->blob->size);
+}
+
+
+//  ---------------------------------------------------------------------------
+//  Write pipe contents to a writer function, in the same format as paste,
+//  in pieces of at most a few KB. Memory use does not depend on the size of
+//  the pipe. This empties the pipe. Returns the number of bytes written, or
+//  -1 if the writer failed.
+
+int64_t
+zs_pipe_paste_to (zs_pipe_t *self, zs_pipe_writer_fn *writer, void *args)
+{
+    paste_t paste;
+    paste.writer = writer;
+    paste.args = args;
+    paste.size = 0;
+    paste.total = 0;
+    paste.rc = 0;
+
+    size_t mark = self->marks_head;
+    size_t index;
+    for (index = 0; index <= self->size && paste.rc == 0; index++) {
+        //  Marks come before the value at their position
+        while (mark < self->marks_tail
+           &&  self->marks [mark].position - self->base == index) {
+            *s_paste_reserve (&paste, 1) = ',';
+            paste.size++;
+            mark++;
+        }
+        if (index < self->size) {
+            if (paste.total || paste.size) {
+                *s_paste_reserve (&paste, 1) = ' ';
+                paste.size++;
+            }
+            s_paste_value (&paste, s_value_at (self, index));
+        }
+    }
+    s_paste_flush (&paste);
+    zs_pipe_purge (self);
+    return paste.rc? -1: paste.total;
+}
+
 
-    //  Ensure cursor points to first valid value, if any
-    if (!value)
-        zlistx_first (source->values);
+//  ---------------------------------------------------------------------------
+//  Write pipe contents to a file descriptor, in the same format as paste.
+//  This empties the pipe. Returns the number of bytes written, or -1 if
+//  there was an error writing to the file descriptor.
+
+static int
+s_write_fd (void *args, const char *data, size_t size)
+{
+    int fd = *(int *) args;
+    while (size) {
+        ssize_t rc = write (fd, data, size);
+        if (rc == -1) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        data += rc;
+        size -= rc;
+    }
+    return 0;
+}
 
-    s_pull_values (self, source);
+int64_t
+zs_pipe_paste_fd (zs_pipe_t *self, int fd)
+{
+    return zs_pipe_paste_to (self, s_write_fd, &fd);
 }
 
 
@@ -464,29 +1576,35 @@ zs_pipe_pull_array (zs_pipe_t *self, zs_pipe_t *source)
 //  Return pipe contents, as string. Caller must free it when done. Values are
 //  separated by spaces. This empties the pipe.
 
+typedef struct {
+    char *data;
+    size_t size;
+    size_t limit;
+} string_t;
+
+static int
+s_write_string (void *args, const char *data, size_t size)
+{
+    string_t *string = (string_t *) args;
+    if (string->size + size + 1 > string->limit) {
+        while (string->size + size + 1 > string->limit)
+            string->limit *= 2;
+        string->data = (char *) realloc (string->data, string->limit);
+        assert (string->data);
+    }
+    memcpy (string->data + string->size, data, size);
+    string->size += size;
+    return 0;
+}
+
 char *
 zs_pipe_paste (zs_pipe_t *self)
 {
-    //  We use an extensible CZMQ chunk
-    zchunk_t *chunk = zchunk_new (NULL, 256);
-
-    while ((self->value = (value_t *) zlistx_detach (self->values, NULL))) {
-        const char *string = zs_pipe_string (self);
-        if (streq (string, "|"))
-            zchunk_extend (chunk, ",", 1);
-        else {
-            if (zchunk_size (chunk))
-                zchunk_extend (chunk, " ", 1);
-            zchunk_extend (chunk, string, strlen (string));
-        }
-        s_value_destroy (&self->value);
-    }
-    size_t result_size = zchunk_size (chunk);
-    char *result = (char *) malloc (result_size + 1);
-    memcpy (result, (char *) zchunk_data (chunk), result_size);
-    result [result_size] = 0;
-    zchunk_destroy (&chunk);
-    return result;
+    string_t string = { (char *) malloc (256), 0, 256 };
+    assert (string.data);
+    zs_pipe_paste_to (self, s_write_string, &string);
+    string.data [string.size] = 0;
+    return string.data;
 }
 
 
@@ -496,36 +1614,76 @@ zs_pipe_paste (zs_pipe_t *self)
 void
 zs_pipe_print (zs_pipe_t *self, const char *prefix)
 {
-    if (zlistx_size (self->values)) {
+    if (self->size || s_marks (self)) {
         size_t limit = 10;          //  Keep things simple with long pipes
         printf ("%s", prefix);
-        value_t *value = (value_t *) zlistx_first (self->values);
-        while (value) {
-            printf ("[%s] ", s_value_string (value, self));
-            value = (value_t *) zlistx_next (self->values);
-            if (--limit == 0) {
-                printf ("...");
-                break;
+        size_t mark = self->marks_head;
+        size_t index;
+        for (index = 0; index <= self->size && limit; index++) {
+            while (mark < self->marks_tail
+               &&  self->marks [mark].position - self->base == index
+               &&  limit) {
+                printf ("[|] ");
+                mark++;
+                limit--;
+            }
+            if (index < self->size && limit) {
+                printf ("[%s] ", s_value_string (s_value_at (self, index), self));
+                limit--;
             }
         }
+        if (limit == 0)
+            printf ("...");
         printf ("\n");
     }
 }
 
 
 //  ---------------------------------------------------------------------------
-//  Empty the pipe of any values it might contain.
+//  Empty the pipe of any values it might contain, and the register. The pipe
+//  keeps its ring buffer, so refilling it does not allocate.
 
 void
 zs_pipe_purge (zs_pipe_t *self)
 {
-    zlistx_purge (self->values);
+    size_t index;
+    for (index = 0; index < self->size; index++) {
+        //  Work on a copy, as the ring may be shared
+        value_t value = *s_value_at (self, index);
+        s_value_free (&value);
+    }
+    s_value_free (&self->value);
+    if (self->share)
+        s_release (self);
+    self->head = 0;
+    self->size = 0;
+    self->marks_head = 0;
+    self->marks_tail = 0;
+    self->taken = self->sent;
 }
 
 
 //  ---------------------------------------------------------------------------
 //  Selftest
 
+//  Test destructor that counts the blobs it frees
+static void
+s_test_blob_free (void *data, void *hint)
+{
+    (*(size_t *) hint)++;
+}
+
+//  Test writer that checks each piece against the expected output
+static int
+s_test_writer (void *args, const char *data, size_t size)
+{
+    char **expected = (char **) args;
+    assert (size <= PASTE_BUFFER);
+    assert (memcmp (*expected, data, size) == 0);
+    *expected += size;
+    return 0;
+}
+
 void
 zs_pipe_test (bool verbose)
 {
@@ -534,6 +1692,9 @@ zs_pipe_test (bool verbose)
         printf ("\n");
 
     //  @selftest
+    //  Values must stay compact
+    assert (sizeof (value_t) <= 16);
+
     zs_pipe_t *pipe = zs_pipe_new ();
     zs_pipe_t *copy = zs_pipe_new ();
 
@@ -649,6 +1810,20 @@ zs_pipe_test (bool verbose)
     assert (whole == 6);
     assert (!zs_pipe_recv (copy));
 
+    //  Test marks survive receives, and paste in the right place
+    zs_pipe_purge (pipe);
+    zs_pipe_mark (pipe);
+    zs_pipe_send_whole (pipe, 1);
+    zs_pipe_send_whole (pipe, 2);
+    zs_pipe_mark (pipe);
+    zs_pipe_send_whole (pipe, 3);
+    zs_pipe_mark (pipe);
+    zs_pipe_mark (pipe);
+    assert (zs_pipe_recv_whole (pipe) == 1);
+    results = zs_pipe_paste (pipe);
+    assert (streq (results, "2, 3,,"));
+    zstr_free (&results);
+
     //  Test casting
     zs_pipe_purge (pipe);
     zs_pipe_send_whole (pipe, 1);
@@ -663,6 +1838,292 @@ zs_pipe_test (bool verbose)
     real = zs_pipe_recv_real (pipe);
     assert (real == 3.0);
 
+    //  Test ring buffer growth and wrap-around
+    int64_t index;
+    for (index = 0; index < 100; index++)
+        zs_pipe_send_whole (pipe, index);
+    for (index = 0; index < 90; index++)
+        assert (zs_pipe_recv_whole (pipe) == index);
+    for (index = 100; index < 1000; index++)
+        zs_pipe_send_whole (pipe, index);
+    zs_pipe_pull_greedy (copy, pipe);
+    for (index = 90; index < 1000; index++)
+        assert (zs_pipe_recv_whole (copy) == index);
+    assert (!zs_pipe_recv (copy));
+    assert (!zs_pipe_recv (pipe));
+
+    //  Test type counts move with spliced phrases
+    zs_pipe_send_real  (pipe, 1.0);
+    zs_pipe_mark (pipe);
+    zs_pipe_send_whole (pipe, 2);
+    zs_pipe_send_string (pipe, "3");
+    zs_pipe_pull_greedy (copy, pipe);
+    assert (zs_pipe_realish (pipe));
+    assert (!zs_pipe_realish (copy));
+    zs_pipe_mark (pipe);
+    zs_pipe_pull_modest (copy, pipe);
+    assert (!zs_pipe_realish (pipe));
+    assert (zs_pipe_realish (copy));
+    results = zs_pipe_paste (copy);
+    assert (streq (results, "2 3 1"));
+    zstr_free (&results);
+    assert (!zs_pipe_realish (copy));
+
+    //  Test number formatting; reals must read back exactly
+    zs_pipe_send_whole (pipe, INT64_MIN);
+    zs_pipe_send_whole (pipe, 1234567);
+    zs_pipe_send_real (pipe, 0.1);
+    zs_pipe_send_real (pipe, -2.5);
+    zs_pipe_send_real (pipe, 1.0 / 3);
+    zs_pipe_send_real (pipe, 1e-7);
+    zs_pipe_send_real (pipe, 1e20);
+    zs_pipe_send_real (pipe, 1e6);
+    results = zs_pipe_paste (pipe);
+    assert (streq (results, "-9223372036854775808 1234567 0.1 -2.5 "
+                            "0.3333333333333333 1e-07 1e+20 1000000"));
+    zstr_free (&results);
+
+    //  Reals that need all 17 digits must still round the last one right
+    zs_pipe_send_real (pipe, 0.1 + 0.2);
+    zs_pipe_send_real (pipe, 2.0 / 3);
+    zs_pipe_send_real (pipe, 123456789012345.67);
+    zs_pipe_send_real (pipe, 1e22);
+    zs_pipe_send_real (pipe, 1.0000000000000001e23);
+    results = zs_pipe_paste (pipe);
+    assert (streq (results, "0.30000000000000004 0.6666666666666666 "
+                            "123456789012345.67 1e+22 1.0000000000000001e+23"));
+    zstr_free (&results);
+
+    //  Test streaming paste gives same output as paste, in bounded pieces
+    for (index = 0; index < 10000; index++) {
+        zs_pipe_send_whole (pipe, index);
+        zs_pipe_send_real (pipe, index / 7.0);
+        if (index % 100 == 0) {
+            zs_pipe_send_string (pipe, "Hello");
+            zs_pipe_mark (pipe);
+        }
+        zs_pipe_send_whole (copy, index);
+        zs_pipe_send_real (copy, index / 7.0);
+        if (index % 100 == 0) {
+            zs_pipe_send_string (copy, "Hello");
+            zs_pipe_mark (copy);
+        }
+    }
+    results = zs_pipe_paste (pipe);
+    char *expected = results;
+    assert (zs_pipe_paste_to (copy, s_test_writer, &expected) == (int64_t) strlen (results));
+    assert (*expected == 0);
+    zstr_free (&results);
+
+    //  Test strings allocated from a slab find their way back to it
+    zs_slab_t *slab = zs_slab_new ();
+    zs_pipe_set_slab (pipe, slab);
+    zs_pipe_send_string (pipe, "Hello");
+    zs_pipe_send_string (pipe, "World");
+    zs_pipe_pull_single (copy, pipe);
+    assert (zs_slab_used (slab) == 2);
+    assert (streq (zs_pipe_recv_string (pipe), "Hello"));
+    zs_pipe_purge (pipe);
+    assert (zs_slab_used (slab) == 1);
+    results = zs_pipe_paste (copy);
+    assert (streq (results, "World"));
+    zstr_free (&results);
+    assert (zs_slab_used (slab) == 0);
+    zs_pipe_set_slab (pipe, NULL);
+    zs_slab_destroy (&slab);
+
+    //  Test strings coerce to numbers, and say what kind of number they hold
+    zs_pipe_send_string (pipe, "12");
+    zs_pipe_send_string (pipe, "13.5");
+    zs_pipe_send_string (pipe, "Hello");
+    zs_pipe_pull_greedy (copy, pipe);
+    assert (zs_pipe_recv (copy));
+    assert (zs_pipe_numeric (copy) == 'w');
+    assert (zs_pipe_whole (copy) == 12);
+    assert (zs_pipe_real (copy) == 12.0);
+    assert (zs_pipe_recv (copy));
+    assert (zs_pipe_numeric (copy) == 'r');
+    assert (zs_pipe_whole (copy) == 13);
+    assert (zs_pipe_real (copy) == 13.5);
+    assert (zs_pipe_real (copy) == 13.5);
+    assert (zs_pipe_recv (copy));
+    assert (zs_pipe_numeric (copy) == '-');
+    assert (zs_pipe_whole (copy) == 0);
+    assert (streq (zs_pipe_string (copy), "Hello"));
+    assert (!zs_pipe_recv (copy));
+    assert (zs_pipe_numeric (copy) == -1);
+
+    //  Test sending and receiving in blocks
+    int64_t wholes [] = { 1, 2, 3, 4, 5 };
+    zs_pipe_send_wholes (pipe, wholes, 5);
+    zs_pipe_mark (pipe);
+    zs_pipe_send_string (pipe, "6");
+    zs_pipe_send_real (pipe, 7.0);
+    assert (zs_pipe_size (pipe) == 7);
+    assert (zs_pipe_count (pipe, 'w') == 5);
+    assert (zs_pipe_count (pipe, 's') == 1);
+    assert (zs_pipe_count (pipe, 'r') == 1);
+    assert (zs_pipe_recv_wholes (pipe, wholes, 3) == 3);
+    assert (wholes [0] == 1 && wholes [2] == 3);
+    double reals [5];
+    assert (zs_pipe_recv_reals (pipe, reals, 5) == 4);
+    assert (reals [0] == 4.0 && reals [2] == 6.0 && reals [3] == 7.0);
+    assert (zs_pipe_recv_reals (pipe, reals, 5) == 0);
+    assert (!zs_pipe_realish (pipe));
+    zs_pipe_send_reals (pipe, reals, 4);
+    assert (zs_pipe_count (pipe, 'r') == 4);
+    results = zs_pipe_paste (pipe);
+    assert (streq (results, "4 5 6 7"));
+    zstr_free (&results);
+
+    //  Block receives stop at the end of a phrase of a single type
+    zs_pipe_send_wholes (pipe, wholes, 2);
+    zs_pipe_mark (pipe);
+    zs_pipe_send_reals (pipe, reals, 2);
+    assert (zs_pipe_count (pipe, 'm') == 1);
+    assert (zs_pipe_recv_wholes (pipe, wholes, 5) == 2);
+    assert (zs_pipe_count (pipe, 'r') == 2);
+    assert (zs_pipe_recv_reals (pipe, reals, 5) == 2);
+    assert (zs_pipe_count (pipe, 'm') == 0);
+
+    //  A capacity is a limit that producers check, not a hard stop
+    zs_pipe_set_capacity (pipe, 2);
+    zs_pipe_send_whole (pipe, 1);
+    assert (!zs_pipe_full (pipe));
+    zs_pipe_send_whole (pipe, 2);
+    assert (zs_pipe_full (pipe));
+    zs_pipe_send_whole (pipe, 3);
+    assert (zs_pipe_size (pipe) == 3);
+    zs_pipe_purge (pipe);
+    assert (!zs_pipe_full (pipe));
+    zs_pipe_set_capacity (pipe, 0);
+
+    //  Tees share values until one of the pipes changes them
+    zs_pipe_send_whole (pipe, 1);
+    zs_pipe_send_string (pipe, "2");
+    zs_pipe_mark (pipe);
+    zs_pipe_send_real (pipe, 3.5);
+    zs_pipe_t *first = zs_pipe_new ();
+    zs_pipe_t *second = zs_pipe_new ();
+    zs_pipe_tee (first, pipe);
+    zs_pipe_tee (second, pipe);
+    assert (zs_pipe_recv_wholes (first, wholes, 5) == 3);
+    assert (wholes [0] == 1 && wholes [1] == 2 && wholes [2] == 4);
+    zs_pipe_send_whole (second, 4);
+    zs_pipe_pull_greedy (copy, second);
+    results = zs_pipe_paste (copy);
+    assert (streq (results, "3.5 4"));
+    zstr_free (&results);
+    results = zs_pipe_paste (second);
+    assert (streq (results, "1 2"));
+    zstr_free (&results);
+    results = zs_pipe_paste (pipe);
+    assert (streq (results, "1 2, 3.5"));
+    zstr_free (&results);
+    zs_pipe_destroy (&first);
+    zs_pipe_destroy (&second);
+
+    //  A large pipe spills its ring to a file, and reads back in order
+    zs_pipe_t *spill = zs_pipe_new ();
+    zs_pipe_set_spill (spill, 1000);
+    for (whole = 0; whole < 10000; whole++)
+        zs_pipe_send_whole (spill, whole);
+    zs_pipe_send_string (spill, "end");
+#if defined (__UNIX__)
+    assert (spill->spilled);
+#endif
+    for (whole = 0; whole < 10000; whole++)
+        assert (zs_pipe_recv_whole (spill) == whole);
+    assert (streq (zs_pipe_recv_string (spill), "end"));
+    zs_pipe_destroy (&spill);
+
+    //  Blobs move by reference, and are freed by the last value to go
+    size_t freed = 0;
+    zs_pipe_send_blob (pipe, "\0abc", 4, s_test_blob_free, &freed);
+    zs_pipe_tee (copy, pipe);
+    zs_pipe_t *blobs = zs_pipe_new ();
+    zs_pipe_pull_single (blobs, copy);
+    assert (zs_pipe_count (blobs, 'b') == 1);
+    assert (zs_pipe_recv (blobs));
+    assert (zs_pipe_type (blobs) == 'b');
+    assert (zs_pipe_numeric (blobs) == '-');
+    assert (zs_pipe_blob_size (blobs) == 4);
+    assert (memcmp (zs_pipe_blob (blobs), "\0abc", 4) == 0);
+    zs_pipe_forward (copy, blobs);
+    zs_pipe_destroy (&blobs);
+    results = zs_pipe_paste (pipe);
+    assert (memcmp (results, "\0abc", 4) == 0);
+    zstr_free (&results);
+    assert (freed == 0);
+    assert (zs_pipe_recv (copy));
+    assert (zs_pipe_blob_size (copy) == 4);
+    assert (streq (zs_pipe_string (copy), ""));
+    zs_pipe_purge (copy);
+    assert (freed == 1);
+    zchunk_t *chunk = zchunk_new ("chunk", 5);
+    zs_pipe_send_chunk (pipe, &chunk);
+    assert (chunk == NULL);
+    zs_pipe_purge (pipe);
+
+    //  Cursors read values without taking them off the pipe
+    assert (!zs_pipe_first (pipe));
+    zs_pipe_send_whole (pipe, 1);
+    zs_pipe_send_string (pipe, "two");
+    zs_pipe_mark (pipe);
+    zs_pipe_send_real (pipe, 3.5);
+    int pass;
+    for (pass = 0; pass < 2; pass++) {
+        assert (zs_pipe_first (pipe));
+        assert (zs_pipe_whole (pipe) == 1);
+        assert (zs_pipe_next (pipe));
+        assert (streq (zs_pipe_string (pipe), "two"));
+        assert (zs_pipe_next (pipe));
+        assert (zs_pipe_real (pipe) == 3.5);
+        assert (!zs_pipe_next (pipe));
+        assert (!zs_pipe_next (pipe));
+        assert (zs_pipe_type (pipe) == -1);
+    }
+    assert (zs_pipe_first (pipe));
+    assert (zs_pipe_next (pipe));
+    results = zs_pipe_paste (pipe);
+    assert (streq (results, "1 two, 3.5"));
+    zstr_free (&results);
+    assert (!zs_pipe_recv (pipe));
+
+    //  A function can make two passes over its input, here for the mean
+    //  and then for the variance, and still leave the input in place
+    int64_t samples [] = { 2, 4, 4, 4, 5, 5, 7, 9 };
+    zs_pipe_send_wholes (pipe, samples, 8);
+    double total = 0;
+    bool more;
+    for (more = zs_pipe_first (pipe); more; more = zs_pipe_next (pipe))
+        total += zs_pipe_real (pipe);
+    double mean = total / 8;
+    double squares = 0;
+    for (more = zs_pipe_first (pipe); more; more = zs_pipe_next (pipe))
+        squares += (zs_pipe_real (pipe) - mean) * (zs_pipe_real (pipe) - mean);
+    assert (mean == 5 && squares / 8 == 4);
+    assert (zs_pipe_size (pipe) == 8);
+    zs_pipe_purge (pipe);
+
+    //  Pipes borrow string constants until told to materialize them
+    int64_t buffer [8];
+    assert (zs_pipe_constant_size (5) <= sizeof (buffer));
+    const char *constant = zs_pipe_constant_new (buffer, "12345678", 5);
+    assert (streq (constant, "12345"));
+    zs_pipe_send_constant (pipe, constant);
+    zs_pipe_send_constant (pipe, constant);
+    zs_pipe_tee (copy, pipe);
+    assert (zs_pipe_recv_whole (copy) == 12345);
+    zs_pipe_materialize (copy);
+    zs_pipe_materialize (pipe);
+    memset (buffer, 0, sizeof (buffer));
+    assert (streq (zs_pipe_string (copy), "12345"));
+    assert (streq (zs_pipe_recv_string (copy), "12345"));
+    results = zs_pipe_paste (pipe);
+    assert (streq (results, "12345 12345"));
+    zstr_free (&results);
+
     zs_pipe_destroy (&copy);
     zs_pipe_destroy (&pipe);
     //  @end
@@ -163,7 +163,7 @@ get_next_token (zs_repl_t *self)
 static void
 compile_define_shell (zs_repl_t *self)
 {
-    zs_vm_compile_define (self->vm, "$shell$");
+    zs_vm_compile_shell (self->vm, "$shell$");
 }
 
 
@@ -498,6 +498,18 @@ zs_repl_results (zs_repl_t *self)
 }
 
 
+//  ---------------------------------------------------------------------------
+//  Write pipe results to a file descriptor, after successful execution.
+//  This streams the results rather than building a string. Returns the
+//  number of bytes written, or -1 if there was an error writing.
+
+int64_t
+zs_repl_results_fd (zs_repl_t *self, int fd)
+{
+    return zs_vm_results_fd (self->vm, fd);
+}
+
+
 //  ---------------------------------------------------------------------------
 //  After a syntax error, return position of syntax error in text.
 
@@ -544,6 +556,7 @@ zs_repl_test (bool verbose)
     s_repl_assert (repl, "1 2 3 tally, 1 1 sum, min", "2");
     s_repl_assert (repl, "sum (1 2 3)", "6");
     s_repl_assert (repl, "sum (sum (1 2 3) tally (4 5 6))", "9");
+    s_repl_assert (repl, "1 2 3,, sum, sum ()", "6, 0");
     s_repl_assert (repl, "sum (1 2 3", "");
     s_repl_assert (repl, ")", "6");
     s_repl_assert (repl, "sub: (<hello>)", "");
@@ -557,9 +570,46 @@ zs_repl_test (bool verbose)
     s_repl_assert (repl, "K: (1000 *)", "");
     s_repl_assert (repl, "K (1 2 3)", "1000 2000 3000");
     s_repl_assert (repl, "12.0 .1 +", "12.1");
+    s_repl_assert (repl, "<12> <1.5> <hello>, k", "12000 1500 0");
     s_repl_assert (repl, "1 [1 2] 0.5 [1 2] 0.49 [1 2] tally", "4");
+    s_repl_assert (repl, "0 [1 2] 3 4 tally, 0 [1] 2 3 tally", "2 2");
     s_repl_assert (repl, "times (10) { 1 } tally", "10");
     s_repl_assert (repl, "2 times { <hello> 3 times { <world> } } tally", "8");
+    s_repl_assert (repl, "3 count { 0 countdown { } } 2 countdown { }", "1 2 3 2 1");
+    s_repl_assert (repl, "count (3 10 5) { }", "10 15 20");
+    s_repl_assert (repl, "1 1 0 assert 1 [ 9 ]", "");
+    s_repl_assert (repl, "1 [ 0 [ 5 ] 6 ] 7", "6 7");
+    s_repl_assert (repl, "count (3 10 5 7) { } 1 [ 2 ] 0 [ 3 ]", "10 15 20 2 3");
+    s_repl_assert (repl, "1 1 5 assert 2 k", "5000 2000");
+    s_repl_assert (repl, "1 1 5 assert, 1 2 sum", "8");
+    s_repl_assert (repl, "count (3 10 5 7) { } 2 k", "10 15 20 7000 2000");
+    s_repl_assert (repl, "1 1 5 assert sum (1 2) 2 k", "3 2000");
+    s_repl_assert (repl, "1 k, 5 minutes", "1000, 300");
+    s_repl_assert (repl, "1 1 5 assert, 1 2 +", "7 3");
+
+    //  Results written to a file descriptor match the results string
+    int fds [2];
+    assert (pipe (fds) == 0);
+    const char *input = "1 2, <hello>, 2.5 sum";
+    zs_repl_execute (repl, input);
+    char *expected = strdup (zs_repl_results (repl));
+    assert (streq (expected, "1 2, hello 2.5"));
+    zs_repl_execute (repl, input);
+    int64_t size = zs_repl_results_fd (repl, fds [1]);
+    assert (size == (int64_t) strlen (expected));
+    char buffer [256];
+    assert (read (fds [0], buffer, sizeof (buffer)) == size);
+    assert (memcmp (buffer, expected, size) == 0);
+    free (expected);
+    //  Empty results write nothing
+    zs_repl_execute (repl, "");
+    assert (zs_repl_results_fd (repl, fds [1]) == 0);
+    close (fds [1]);
+    //  A failed write returns -1
+    zs_repl_execute (repl, input);
+    assert (zs_repl_results_fd (repl, fds [1]) == -1);
+    close (fds [0]);
+
     zs_repl_destroy (&repl);
     //  @end
     printf ("OK\n");
@@ -32,7 +32,9 @@ main (int argc, char *argv [])
     printf ("Running zs selftests...\n");
 
     zs_pipe_test (verbose);
+    zs_spsc_test (verbose);
     zs_vm_test (verbose);
+    zs_slab_test (verbose);
     zs_lex_test (verbose);
     zs_repl_test (verbose);
 
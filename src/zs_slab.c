@@ -0,0 +1,261 @@
+/*  =========================================================================
+    zs_slab - ZeroScript slab allocator
+
+    Copyright (c) the Contributors as noted in the AUTHORS file.
+    This file is part of the ZeroScript language, http://zeroscript.org.
+
+    This Source Code Form is subject to the terms of the Mozilla Public
+    License, v. 2.0. If a copy of the MPL was not distributed with this
+    file, You can obtain one at http://mozilla.org/MPL/2.0/.
+    =========================================================================
+*/
+
+/*
+@header
+    A slab hands out small blocks of memory, such as string values, without
+    going to the heap for each one.
+@discuss
+    The slab carves blocks out of large chunks, in a few size classes, and
+    keeps a free list per class, so a freed block is reused by the next
+    allocation of that class. Each block carries a header with its owner
+    and size class. A block can thus move from pipe to pipe and still find
+    its way home when freed. Blocks too large for any class, and blocks
+    allocated without a slab, come from the heap.
+
+    The virtual machine owns one slab, and resets it at the start of each
+    run. A reset forgets the free lists and carves again from the start of
+    the first chunk, so each run starts with compact, unfragmented memory.
+@end
+*/
+
+#include "zs_classes.h"
+
+//  Block sizes, including header; larger blocks go to the heap
+#define SLAB_CLASSES    5
+static const size_t
+s_class_size [SLAB_CLASSES] = { 32, 64, 128, 256, 512 };
+
+//  Size class of heap blocks
+#define SLAB_HEAP       SLAB_CLASSES
+
+//  We allocate memory for the slab in chunks of this size
+#define SLAB_CHUNK      65536
+
+//  Each block starts with this header, which is 16 bytes on 64-bit systems,
+//  so the caller's data stays well aligned
+typedef struct _block_t {
+    zs_slab_t *slab;            //  Owning slab, or NULL for heap blocks
+    union {
+        size_t klass;           //  Size class, while block is allocated
+        struct _block_t *next;  //  Next block, while on a free list
+    };
+} block_t;
+
+//  Structure of our class
+struct _zs_slab_t {
+    block_t *free_list [SLAB_CLASSES];
+    char **chunks;              //  All chunks we've allocated
+    size_t nbr_chunks;          //  Number of chunks allocated
+    size_t next_chunk;          //  Next chunk to carve from
+    char *cursor;               //  Next free byte in current chunk
+    char *limit;                //  End of current chunk
+    size_t used;                //  Number of blocks in use
+};
+
+
+//  ---------------------------------------------------------------------------
+//  Create a new empty slab allocator. Returns the reference if successful,
+//  or NULL if construction failed due to lack of available memory.
+
+zs_slab_t *
+zs_slab_new (void)
+{
+    zs_slab_t *self = (zs_slab_t *) zmalloc (sizeof (zs_slab_t));
+    return self;
+}
+
+
+//  ---------------------------------------------------------------------------
+//  Destroy the slab allocator and free all memory used by it. Any blocks
+//  still allocated from the slab become invalid.
+
+void
+zs_slab_destroy (zs_slab_t **self_p)
+{
+    assert (self_p);
+    if (*self_p) {
+        zs_slab_t *self = *self_p;
+        while (self->nbr_chunks)
+            free (self->chunks [--self->nbr_chunks]);
+        free (self->chunks);
+        free (self);
+        *self_p = NULL;
+    }
+}
+
+
+//  Carve a new block of the given class from the current chunk, moving to
+//  the next chunk, or allocating one, if needed
+
+static block_t *
+s_carve (zs_slab_t *self, size_t klass)
+{
+    size_t size = s_class_size [klass];
+    if (self->cursor + size > self->limit) {
+        if (self->next_chunk == self->nbr_chunks) {
+            self->chunks = (char **) realloc (self->chunks,
+                (self->nbr_chunks + 1) * sizeof (char *));
+            assert (self->chunks);
+            self->chunks [self->nbr_chunks] = (char *) malloc (SLAB_CHUNK);
+            assert (self->chunks [self->nbr_chunks]);
+            self->nbr_chunks++;
+        }
+        self->cursor = self->chunks [self->next_chunk++];
+        self->limit = self->cursor + SLAB_CHUNK;
+    }
+    block_t *block = (block_t *) self->cursor;
+    self->cursor += size;
+    return block;
+}
+
+
+//  ---------------------------------------------------------------------------
+//  Allocate a block of at least size bytes. If self is NULL, allocates the
+//  block from the heap. Each block knows its owner, so it can be freed
+//  without reference to the slab. Never returns NULL.
+
+void *
+zs_slab_alloc (zs_slab_t *self, size_t size)
+{
+    size += sizeof (block_t);
+    block_t *block;
+    if (self) {
+        size_t klass;
+        for (klass = 0; klass < SLAB_CLASSES; klass++) {
+            if (size <= s_class_size [klass]) {
+                block = self->free_list [klass];
+                if (block)
+                    self->free_list [klass] = block->next;
+                else
+                    block = s_carve (self, klass);
+                block->slab = self;
+                block->klass = klass;
+                self->used++;
+                return block + 1;
+            }
+        }
+    }
+    block = (block_t *) malloc (size);
+    assert (block);
+    block->slab = NULL;
+    block->klass = SLAB_HEAP;
+    return block + 1;
+}
+
+
+//  ---------------------------------------------------------------------------
+//  Free a block allocated by zs_slab_alloc, returning it to the slab or
+//  heap it came from. Does nothing if block is NULL.
+
+void
+zs_slab_free (void *data)
+{
+    if (data) {
+        block_t *block = (block_t *) data - 1;
+        zs_slab_t *self = block->slab;
+        if (self) {
+            size_t klass = block->klass;
+            block->next = self->free_list [klass];
+            self->free_list [klass] = block;
+            self->used--;
+        }
+        else
+            free (block);
+    }
+}
+
+
+//  ---------------------------------------------------------------------------
+//  Return the number of blocks allocated from the slab and not yet freed.
+
+size_t
+zs_slab_used (zs_slab_t *self)
+{
+    return self->used;
+}
+
+
+//  ---------------------------------------------------------------------------
+//  Release the slab's free lists in one step, so later allocations are
+//  carved afresh from the start of the slab. The slab keeps its memory.
+//  Only works when all blocks have been freed; returns 0 if the slab was
+//  reset, or -1 if blocks are still in use.
+
+int
+zs_slab_reset (zs_slab_t *self)
+{
+    if (self->used)
+        return -1;
+    memset (self->free_list, 0, sizeof (self->free_list));
+    self->next_chunk = 0;
+    self->cursor = NULL;
+    self->limit = NULL;
+    return 0;
+}
+
+
+//  ---------------------------------------------------------------------------
+//  Selftest
+
+void
+zs_slab_test (bool verbose)
+{
+    printf (" * zs_slab: ");
+    if (verbose)
+        printf ("\n");
+
+    //  @selftest
+    zs_slab_t *slab = zs_slab_new ();
+    assert (slab);
+
+    //  Freed blocks are reused by the next block of the same class
+    char *first = (char *) zs_slab_alloc (slab, 10);
+    char *second = (char *) zs_slab_alloc (slab, 10);
+    assert (first != second);
+    strcpy (first, "Hello");
+    strcpy (second, "World");
+    assert (zs_slab_used (slab) == 2);
+    zs_slab_free (first);
+    char *third = (char *) zs_slab_alloc (slab, 12);
+    assert (third == first);
+    assert (streq (second, "World"));
+
+    //  Large blocks, and blocks without a slab, come from the heap
+    char *large = (char *) zs_slab_alloc (slab, 10000);
+    memset (large, 0, 10000);
+    char *heap = (char *) zs_slab_alloc (NULL, 10);
+    assert (zs_slab_used (slab) == 2);
+    zs_slab_free (large);
+    zs_slab_free (heap);
+    zs_slab_free (NULL);
+
+    //  Fill more than one chunk, then reset and carve again
+    assert (zs_slab_reset (slab) == -1);
+    zs_slab_free (second);
+    zs_slab_free (third);
+    char *blocks [1000];
+    size_t index;
+    for (index = 0; index < 1000; index++)
+        blocks [index] = (char *) zs_slab_alloc (slab, index % 400);
+    for (index = 0; index < 1000; index++)
+        zs_slab_free (blocks [index]);
+    assert (zs_slab_used (slab) == 0);
+    assert (zs_slab_reset (slab) == 0);
+    first = (char *) zs_slab_alloc (slab, 10);
+    assert (first == blocks [0]);
+    zs_slab_free (first);
+
+    zs_slab_destroy (&slab);
+    //  @end
+    printf ("OK\n");
+}
@@ -0,0 +1,77 @@
+/*  =========================================================================
+    zs_slab - ZeroScript slab allocator
+
+    Copyright (c) the Contributors as noted in the AUTHORS file.
+    This file is part of the ZeroScript language, http://zeroscript.org.
+
+    This Source Code Form is subject to the terms of the Mozilla Public
+    License, v. 2.0. If a copy of the MPL was not distributed with this
+    file, You can obtain one at http://mozilla.org/MPL/2.0/.
+    =========================================================================
+*/
+
+#ifndef ZS_SLAB_H_INCLUDED
+#define ZS_SLAB_H_INCLUDED
+
+#include <czmq.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//  Opaque class structure
+#ifndef ZS_SLAB_T_DEFINED
+typedef struct _zs_slab_t zs_slab_t;
+#define ZS_SLAB_T_DEFINED
+#endif
+
+//  @interface
+//  Create a new empty slab allocator. Returns the reference if successful,
+//  or NULL if construction failed due to lack of available memory.
+zs_slab_t *
+    zs_slab_new (void);
+
+//  Destroy the slab allocator and free all memory used by it. Any blocks
+//  still allocated from the slab become invalid.
+void
+    zs_slab_destroy (zs_slab_t **self_p);
+
+//  Allocate a block of at least size bytes. If self is NULL, allocates the
+//  block from the heap. Each block knows its owner, so it can be freed
+//  without reference to the slab. Never returns NULL.
+void *
+    zs_slab_alloc (zs_slab_t *self, size_t size);
+
+//  Free a block allocated by zs_slab_alloc, returning it to the slab or
+//  heap it came from. Does nothing if block is NULL.
+void
+    zs_slab_free (void *block);
+
+//  Return the number of blocks allocated from the slab and not yet freed.
+size_t
+    zs_slab_used (zs_slab_t *self);
+
+//  Release the slab's free lists in one step, so later allocations are
+//  carved afresh from the start of the slab. The slab keeps its memory.
+//  Only works when all blocks have been freed; returns 0 if the slab was
+//  reset, or -1 if blocks are still in use.
+int
+    zs_slab_reset (zs_slab_t *self);
+
+//  Self test of this class
+void
+    zs_slab_test (bool animate);
+//  @end
+
+//  Slabs are private to the library, and so is this part of the zs_pipe
+//  API: allocate string values from the given slab, instead of the heap.
+//  Strings already in the pipe are not affected. The slab must outlive any
+//  strings allocated from it.
+void
+    zs_pipe_set_slab (zs_pipe_t *self, zs_slab_t *slab);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,432 @@
+/*  =========================================================================
+    zs_spsc - ZeroScript cross-thread pipe
+
+    Copyright (c) the Contributors as noted in the AUTHORS file.
+    This file is part of the ZeroScript language, http://zeroscript.org.
+
+    This Source Code Form is subject to the terms of the Mozilla Public
+    License, v. 2.0. If a copy of the MPL was not distributed with this
+    file, You can obtain one at http://mozilla.org/MPL/2.0/.
+    =========================================================================
+*/
+
+/*
+@header
+    A cross-thread pipe carries values and phrase marks from one thread to
+    another, so two virtual machines can run as stages of a pipeline on
+    separate cores.
+@discuss
+    This is a bounded ring for exactly one producer and one consumer. It
+    uses no locks: the producer owns the tail index and the consumer owns
+    the head index, and each thread only reads the other's index. The two
+    indexes sit on separate cache lines, so the threads never write to the
+    same line. Each thread also keeps its own copy of the other's index,
+    and only reloads it when the ring looks full, or empty.
+
+    Values move between a zs_pipe and the ring in batches: the producer
+    fills as many slots as it can and then publishes them with one store,
+    and the consumer takes all published slots and releases them with one
+    store. The waiting forms of these calls spin for a little while, then
+    sleep between retries, so an idle stage does not burn its core.
+
+    Strings are copied to the heap on the way in, as the two pipes may use
+    different slabs, and the consumer frees them on the way out. Blobs are
+    copied into chunks, as their reference counts are not safe to share
+    across threads.
+@end
+*/
+
+#include "zs_classes.h"
+
+//  We keep producer and consumer state this far apart, so they are never on
+//  the same cache line
+#define CACHE_LINE      64
+
+//  Smallest ring we'll create
+#define SPSC_LIMIT      2
+
+//  When waiting for the other thread, we retry this many times before we
+//  start to sleep between retries
+#define SPSC_SPINS      100
+
+//  Each thread reads the other's index with acquire, and writes its own
+//  with release, so slots are filled before they're seen, and emptied
+//  before they're reused
+#if defined (__GNUC__)
+#   define s_load_acquire(index)        __atomic_load_n (index, __ATOMIC_ACQUIRE)
+#   define s_store_release(index,value) __atomic_store_n (index, value, __ATOMIC_RELEASE)
+#elif defined (_MSC_VER)
+//  Volatile accesses have acquire and release semantics on MSVC
+#   define s_load_acquire(index)        (*(volatile size_t *) (index))
+#   define s_store_release(index,value) (*(volatile size_t *) (index) = (value))
+#else
+#   error "zs_spsc needs atomic loads and stores on this compiler"
+#endif
+
+//  This holds one item in the ring, which is a value or a phrase mark
+typedef struct {
+    char type;                  //  'w', 'r', 's', 'b', or 'm' for a mark
+    union {
+        int64_t whole;
+        double real;
+        char *string;           //  Heap copy, owned by the slot
+        zchunk_t *chunk;        //  Copy of blob, owned by the slot
+    };
+} slot_t;
+
+//  Structure of our class
+struct _zs_spsc_t {
+    slot_t *slots;              //  Ring of slots
+    size_t limit;               //  Number of slots, a power of two
+    char pad_1 [CACHE_LINE];
+    size_t tail;                //  Producer: next slot to fill
+    size_t head_cache;          //  Producer: head as last seen
+    size_t closed;              //  Producer: set after last publish
+    char pad_2 [CACHE_LINE];
+    size_t head;                //  Consumer: next slot to take
+    size_t tail_cache;          //  Consumer: tail as last seen
+    char pad_3 [CACHE_LINE];
+};
+
+
+//  ---------------------------------------------------------------------------
+//  Create a new cross-thread pipe that holds up to limit items, where values
+//  and phrase marks each count as one item. The limit is rounded up to a
+//  power of two. Returns the reference if successful, or NULL if
+//  construction failed due to lack of available memory.
+
+zs_spsc_t *
+zs_spsc_new (size_t limit)
+{
+    zs_spsc_t *self = (zs_spsc_t *) zmalloc (sizeof (zs_spsc_t));
+    if (self) {
+        self->limit = SPSC_LIMIT;
+        while (self->limit < limit)
+            self->limit *= 2;
+        self->slots = (slot_t *) malloc (self->limit * sizeof (slot_t));
+        if (!self->slots)
+            zs_spsc_destroy (&self);
+    }
+    return self;
+}
+
+
+//  ---------------------------------------------------------------------------
+//  Destroy the cross-thread pipe and free all memory used by it, including
+//  any items not yet consumed. Neither thread may use the pipe after this.
+
+void
+zs_spsc_destroy (zs_spsc_t **self_p)
+{
+    assert (self_p);
+    if (*self_p) {
+        zs_spsc_t *self = *self_p;
+        size_t index;
+        for (index = self->head; index != self->tail; index++) {
+            slot_t *slot = &self->slots [index & (self->limit - 1)];
+            if (slot->type == 's')
+                free (slot->string);
+            else
+            if (slot->type == 'b')
+                zchunk_destroy (&slot->chunk);
+        }
+        free (self->slots);
+        free (self);
+        *self_p = NULL;
+    }
+}
+
+
+//  ---------------------------------------------------------------------------
+//  Producer: move as many values and phrase marks as fit from the source
+//  pipe into the cross-thread pipe, and publish them to the consumer in one
+//  step. Returns the number of items moved, which is zero if the cross-
+//  thread pipe is full or the source pipe is empty. Never blocks.
+
+size_t
+zs_spsc_publish (zs_spsc_t *self, zs_pipe_t *source)
+{
+    size_t tail = self->tail;
+    size_t space = self->limit - (tail - self->head_cache);
+    if (space < zs_pipe_size (source) + zs_pipe_count (source, 'm')) {
+        //  Consumer may have freed more slots since we last looked
+        self->head_cache = s_load_acquire (&self->head);
+        space = self->limit - (tail - self->head_cache);
+    }
+    size_t moved;
+    for (moved = 0; moved < space; moved++) {
+        slot_t *slot = &self->slots [(tail + moved) & (self->limit - 1)];
+        if (zs_pipe_recv_mark (source))
+            slot->type = 'm';
+        else
+        if (zs_pipe_recv (source)) {
+            slot->type = zs_pipe_type (source);
+            if (slot->type == 'w')
+                slot->whole = zs_pipe_whole (source);
+            else
+            if (slot->type == 'r')
+                slot->real = zs_pipe_real (source);
+            else
+            if (slot->type == 's')
+                slot->string = strdup (zs_pipe_string (source));
+            else
+                slot->chunk = zchunk_new (zs_pipe_blob (source), zs_pipe_blob_size (source));
+        }
+        else
+            break;
+    }
+    if (moved)
+        s_store_release (&self->tail, tail + moved);
+    return moved;
+}
+
+
+//  Back off before the next retry of a wait that started at attempt zero.
+//  Returns false if the expiry time has passed; an expiry of -1 means we
+//  wait forever.
+
+static bool
+s_backoff (size_t attempt, int64_t expiry)
+{
+    if (expiry != -1 && zclock_mono () >= expiry)
+        return false;
+    if (attempt >= SPSC_SPINS)
+        zclock_sleep (1);
+    return true;
+}
+
+
+//  ---------------------------------------------------------------------------
+//  Producer: publish as for zs_spsc_publish, waiting while the cross-thread
+//  pipe is full. Gives up after timeout msecs, or waits forever if timeout
+//  is -1. Returns the number of items moved, which is zero if the timeout
+//  expired or the source pipe is empty.
+
+size_t
+zs_spsc_publish_wait (zs_spsc_t *self, zs_pipe_t *source, int timeout)
+{
+    int64_t expiry = timeout < 0? -1: zclock_mono () + timeout;
+    size_t attempt = 0;
+    size_t moved;
+    while ((moved = zs_spsc_publish (self, source)) == 0
+       &&  (zs_pipe_size (source) || zs_pipe_count (source, 'm'))
+       &&  s_backoff (attempt++, expiry));
+    return moved;
+}
+
+
+//  ---------------------------------------------------------------------------
+//  Producer: signal that no more items will be published. Call this after
+//  the last publish.
+
+void
+zs_spsc_close (zs_spsc_t *self)
+{
+    s_store_release (&self->closed, 1);
+}
+
+
+//  ---------------------------------------------------------------------------
+//  Consumer: move all published values and phrase marks into the target
+//  pipe, and release their slots to the producer in one step. If the target
+//  pipe has a capacity, stops when it is full, so a slow consumer holds the
+//  producer back. Returns the number of items moved, which is zero if
+//  nothing was published. Never blocks.
+
+size_t
+zs_spsc_consume (zs_spsc_t *self, zs_pipe_t *target)
+{
+    size_t head = self->head;
+    if (head == self->tail_cache)
+        //  Producer may have published more slots since we last looked
+        self->tail_cache = s_load_acquire (&self->tail);
+
+    size_t index;
+    for (index = head; index != self->tail_cache && !zs_pipe_full (target); index++) {
+        slot_t *slot = &self->slots [index & (self->limit - 1)];
+        if (slot->type == 'w')
+            zs_pipe_send_whole (target, slot->whole);
+        else
+        if (slot->type == 'r')
+            zs_pipe_send_real (target, slot->real);
+        else
+        if (slot->type == 's') {
+            zs_pipe_send_string (target, slot->string);
+            free (slot->string);
+        }
+        else
+        if (slot->type == 'b')
+            zs_pipe_send_chunk (target, &slot->chunk);
+        else
+            zs_pipe_mark (target);
+    }
+    if (index != head)
+        s_store_release (&self->head, index);
+    return index - head;
+}
+
+
+//  ---------------------------------------------------------------------------
+//  Consumer: consume as for zs_spsc_consume, waiting while there is nothing
+//  to consume. Gives up after timeout msecs, or waits forever if timeout is
+//  -1. Returns the number of items moved, which is zero if the timeout
+//  expired, the target pipe is full, or the producer is done.
+
+size_t
+zs_spsc_consume_wait (zs_spsc_t *self, zs_pipe_t *target, int timeout)
+{
+    int64_t expiry = timeout < 0? -1: zclock_mono () + timeout;
+    size_t attempt = 0;
+    size_t moved;
+    while ((moved = zs_spsc_consume (self, target)) == 0
+       &&  !zs_pipe_full (target)
+       &&  !zs_spsc_done (self)
+       &&  s_backoff (attempt++, expiry));
+    return moved;
+}
+
+
+//  ---------------------------------------------------------------------------
+//  Consumer: returns true if the producer has closed the pipe and there is
+//  nothing left to consume.
+
+bool
+zs_spsc_done (zs_spsc_t *self)
+{
+    //  The producer publishes its last items before it closes, so once we
+    //  see the close, we also see the final tail
+    return s_load_acquire (&self->closed)
+        && self->head == s_load_acquire (&self->tail);
+}
+
+
+//  ---------------------------------------------------------------------------
+//  Selftest
+
+//  Producer thread for the selftest: sends 10,000 values as phrases of ten
+//  values each, then closes the cross-thread pipe.
+
+static void
+s_test_producer (zsock_t *pipe, void *args)
+{
+    zs_spsc_t *spsc = (zs_spsc_t *) args;
+    zs_pipe_t *source = zs_pipe_new ();
+    zsock_signal (pipe, 0);
+
+    int64_t whole;
+    for (whole = 0; whole < 10000; whole++) {
+        if (whole % 10 == 9) {
+            zs_pipe_send_string (source, "9");
+            zs_pipe_mark (source);
+        }
+        else
+            zs_pipe_send_whole (source, whole % 10);
+        if (zs_pipe_size (source) == 100)
+            while (zs_spsc_publish_wait (spsc, source, -1));
+    }
+    zs_spsc_close (spsc);
+    zs_pipe_destroy (&source);
+}
+
+void
+zs_spsc_test (bool verbose)
+{
+    printf (" * zs_spsc: ");
+    if (verbose)
+        printf ("\n");
+
+    //  @selftest
+    zs_spsc_t *spsc = zs_spsc_new (5);
+    assert (spsc);
+    zs_pipe_t *source = zs_pipe_new ();
+    zs_pipe_t *target = zs_pipe_new ();
+
+    //  Values and marks cross in order, as far as they fit
+    zs_pipe_send_whole (source, 1);
+    zs_pipe_send_real (source, 2.5);
+    zs_pipe_mark (source);
+    zs_pipe_send_string (source, "three");
+    zs_pipe_mark (source);
+    zs_pipe_send_whole (source, 4);
+    zs_pipe_send_whole (source, 5);
+    zs_pipe_send_whole (source, 6);
+    zs_pipe_send_whole (source, 7);
+    assert (zs_spsc_publish (spsc, source) == 8);
+    assert (zs_spsc_publish (spsc, source) == 0);
+    assert (zs_pipe_size (source) == 1);
+    assert (zs_spsc_consume (spsc, target) == 8);
+    assert (zs_spsc_consume (spsc, target) == 0);
+    assert (zs_spsc_publish (spsc, source) == 1);
+    assert (!zs_spsc_done (spsc));
+    zs_spsc_close (spsc);
+    assert (!zs_spsc_done (spsc));
+    assert (zs_spsc_consume (spsc, target) == 1);
+    assert (zs_spsc_done (spsc));
+    assert (zs_pipe_count (target, 'm') == 2);
+    assert (zs_pipe_count (target, 's') == 1);
+
+    //  Greedy pull of the last phrase sees the marks we carried across
+    zs_pipe_t *phrase = zs_pipe_new ();
+    zs_pipe_pull_greedy (phrase, target);
+    assert (zs_pipe_size (phrase) == 4);
+    zs_pipe_destroy (&phrase);
+    char *results = zs_pipe_paste (target);
+    assert (streq (results, "1 2.5, three"));
+    zstr_free (&results);
+
+    //  Blobs cross as copies
+    zchunk_t *chunk = zchunk_new ("\0blob", 5);
+    zs_pipe_send_chunk (source, &chunk);
+    assert (zs_spsc_publish (spsc, source) == 1);
+    assert (zs_spsc_consume (spsc, target) == 1);
+    assert (zs_pipe_recv (target));
+    assert (zs_pipe_blob_size (target) == 5);
+    assert (memcmp (zs_pipe_blob (target), "\0blob", 5) == 0);
+
+    //  Unconsumed strings and blobs are freed with the pipe
+    zs_pipe_purge (target);
+    zs_pipe_send_string (source, "lost");
+    chunk = zchunk_new ("lost", 4);
+    zs_pipe_send_chunk (source, &chunk);
+    assert (zs_spsc_publish (spsc, source) == 2);
+    zs_spsc_destroy (&spsc);
+
+    //  Waits give up after their timeout
+    spsc = zs_spsc_new (2);
+    assert (zs_spsc_consume_wait (spsc, target, 10) == 0);
+    zs_pipe_send_whole (source, 1);
+    zs_pipe_send_whole (source, 2);
+    zs_pipe_send_whole (source, 3);
+    assert (zs_spsc_publish_wait (spsc, source, 10) == 2);
+    assert (zs_spsc_publish_wait (spsc, source, 10) == 0);
+
+    //  Consumer stops at the target pipe's capacity
+    zs_pipe_set_capacity (target, 1);
+    assert (zs_spsc_consume_wait (spsc, target, 10) == 1);
+    assert (zs_spsc_consume_wait (spsc, target, 10) == 0);
+    zs_pipe_purge (target);
+    zs_pipe_purge (source);
+    zs_spsc_destroy (&spsc);
+
+    //  Stream values from a producer thread, through a small target pipe
+    spsc = zs_spsc_new (64);
+    zs_pipe_set_capacity (target, 16);
+    zactor_t *producer = zactor_new (s_test_producer, spsc);
+    int64_t total = 0;
+    size_t values = 0;
+    do {
+        while (zs_pipe_recv (target)) {
+            total += zs_pipe_whole (target);
+            values++;
+        }
+    } while (zs_spsc_consume_wait (spsc, target, -1));
+    zactor_destroy (&producer);
+    assert (values == 10000);
+    assert (total == 45000);
+
+    zs_pipe_destroy (&source);
+    zs_pipe_destroy (&target);
+    zs_spsc_destroy (&spsc);
+    //  @end
+    printf ("OK\n");
+}
@@ -22,18 +22,11 @@
 static void
 s_scale_up (zs_pipe_t *input, zs_pipe_t *output, int64_t scale)
 {
-    if (zs_pipe_type (input) == 'w')
-        zs_pipe_send_whole (output, zs_pipe_whole (input) * scale);
-    else
-    if (zs_pipe_type (input) == 'r')
+    //  Strings could be real or whole; anything not real scales as whole
+    if (zs_pipe_numeric (input) == 'r')
         zs_pipe_send_real (output, zs_pipe_real (input) * (double) scale);
-    else {
-        //  String could be real or whole
-        if ((double) zs_pipe_whole (input) == zs_pipe_real (input))
-            zs_pipe_send_whole (output, zs_pipe_whole (input) * scale);
-        else
-            zs_pipe_send_real (output, zs_pipe_real (input) * scale);
-    }
+    else
+        zs_pipe_send_whole (output, zs_pipe_whole (input) * scale);
 }
 #endif
 
@@ -41,8 +34,8 @@ static int
 s_minutes (zs_vm_t *self, zs_pipe_t *input, zs_pipe_t *output)
 {
     if (zs_vm_probing (self)) {
-        zs_vm_register (self, "minutes", zs_type_modest, "Scale by seconds per minute");
-        zs_vm_register (self, "minute", zs_type_modest, NULL);
+        zs_vm_register_pure (self, "minutes", zs_type_modest, "Scale by seconds per minute");
+        zs_vm_register_pure (self, "minute", zs_type_modest, NULL);
     }
     else {
         //  Process all values on input pipe
@@ -57,8 +50,8 @@ static int
 s_hours (zs_vm_t *self, zs_pipe_t *input, zs_pipe_t *output)
 {
     if (zs_vm_probing (self)) {
-        zs_vm_register (self, "hours", zs_type_modest, "Scale by seconds per hour");
-        zs_vm_register (self, "hour", zs_type_modest, NULL);
+        zs_vm_register_pure (self, "hours", zs_type_modest, "Scale by seconds per hour");
+        zs_vm_register_pure (self, "hour", zs_type_modest, NULL);
     }
     else {
         //  Process all values on input pipe
@@ -73,8 +66,8 @@ static int
 s_days (zs_vm_t *self, zs_pipe_t *input, zs_pipe_t *output)
 {
     if (zs_vm_probing (self)) {
-        zs_vm_register (self, "days", zs_type_modest, "Scale by seconds per day");
-        zs_vm_register (self, "day", zs_type_modest, NULL);
+        zs_vm_register_pure (self, "days", zs_type_modest, "Scale by seconds per day");
+        zs_vm_register_pure (self, "day", zs_type_modest, NULL);
     }
     else {
         //  Process all values on input pipe
@@ -89,8 +82,8 @@ static int
 s_weeks (zs_vm_t *self, zs_pipe_t *input, zs_pipe_t *output)
 {
     if (zs_vm_probing (self)) {
-        zs_vm_register (self, "weeks", zs_type_modest, "Scale by seconds per week");
-        zs_vm_register (self, "week", zs_type_modest, NULL);
+        zs_vm_register_pure (self, "weeks", zs_type_modest, "Scale by seconds per week");
+        zs_vm_register_pure (self, "week", zs_type_modest, NULL);
     }
     else {
         //  Process all values on input pipe
@@ -105,8 +98,8 @@ static int
 s_years (zs_vm_t *self, zs_pipe_t *input, zs_pipe_t *output)
 {
     if (zs_vm_probing (self)) {
-        zs_vm_register (self, "years", zs_type_modest, "Scale by seconds per non-leap year");
-        zs_vm_register (self, "year", zs_type_modest, NULL);
+        zs_vm_register_pure (self, "years", zs_type_modest, "Scale by seconds per non-leap year");
+        zs_vm_register_pure (self, "year", zs_type_modest, NULL);
     }
     else {
         //  Process all values on input pipe
@@ -121,8 +114,8 @@ static int
 s_msecs (zs_vm_t *self, zs_pipe_t *input, zs_pipe_t *output)
 {
     if (zs_vm_probing (self)) {
-        zs_vm_register (self, "msecs", zs_type_modest, "Scale by seconds per 1/1000");
-        zs_vm_register (self, "msec", zs_type_modest, NULL);
+        zs_vm_register_pure (self, "msecs", zs_type_modest, "Scale by seconds per 1/1000");
+        zs_vm_register_pure (self, "msec", zs_type_modest, NULL);
     }
     else {
         //  Process all values on input pipe
@@ -138,7 +131,7 @@ static int
 s__minute (zs_vm_t *self, zs_pipe_t *input, zs_pipe_t *output)
 {
     if (zs_vm_probing (self)) {
-        zs_vm_register (self, "/minute", zs_type_modest, "Scale by minutes per seconds");
+        zs_vm_register_pure (self, "/minute", zs_type_modest, "Scale by minutes per seconds");
     }
     else {
         //  Process all values on input pipe
@@ -154,7 +147,7 @@ static int
 s__hour (zs_vm_t *self, zs_pipe_t *input, zs_pipe_t *output)
 {
     if (zs_vm_probing (self)) {
-        zs_vm_register (self, "/hour", zs_type_modest, "Scale by hours per second");
+        zs_vm_register_pure (self, "/hour", zs_type_modest, "Scale by hours per second");
     }
     else {
         //  Process all values on input pipe
@@ -170,7 +163,7 @@ static int
 s__day (zs_vm_t *self, zs_pipe_t *input, zs_pipe_t *output)
 {
     if (zs_vm_probing (self)) {
-        zs_vm_register (self, "/day", zs_type_modest, "Scale by days per second");
+        zs_vm_register_pure (self, "/day", zs_type_modest, "Scale by days per second");
     }
     else {
         //  Process all values on input pipe
@@ -186,7 +179,7 @@ static int
 s__week (zs_vm_t *self, zs_pipe_t *input, zs_pipe_t *output)
 {
     if (zs_vm_probing (self)) {
-        zs_vm_register (self, "/week", zs_type_modest, "Scale by weeks per second");
+        zs_vm_register_pure (self, "/week", zs_type_modest, "Scale by weeks per second");
     }
     else {
         //  Process all values on input pipe
@@ -202,7 +195,7 @@ static int
 s__year (zs_vm_t *self, zs_pipe_t *input, zs_pipe_t *output)
 {
     if (zs_vm_probing (self)) {
-        zs_vm_register (self, "/year", zs_type_modest, "Scale by non-leap years per second");
+        zs_vm_register_pure (self, "/year", zs_type_modest, "Scale by non-leap years per second");
     }
     else {
         //  Process all values on input pipe
@@ -218,7 +211,7 @@ static int
 s__msec (zs_vm_t *self, zs_pipe_t *input, zs_pipe_t *output)
 {
     if (zs_vm_probing (self)) {
-        zs_vm_register (self, "/msec", zs_type_modest, "Scale by msecs per seconds");
+        zs_vm_register_pure (self, "/msec", zs_type_modest, "Scale by msecs per seconds");
     }
     else {
         //  Process all values on input pipe
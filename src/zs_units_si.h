@@ -22,18 +22,11 @@
 static void
 s_scale_up (zs_pipe_t *input, zs_pipe_t *output, int64_t scale)
 {
-    if (zs_pipe_type (input) == 'w')
-        zs_pipe_send_whole (output, zs_pipe_whole (input) * scale);
-    else
-    if (zs_pipe_type (input) == 'r')
+    //  Strings could be real or whole; anything not real scales as whole
+    if (zs_pipe_numeric (input) == 'r')
         zs_pipe_send_real (output, zs_pipe_real (input) * (double) scale);
-    else {
-        //  String could be real or whole
-        if ((double) zs_pipe_whole (input) == zs_pipe_real (input))
-            zs_pipe_send_whole (output, zs_pipe_whole (input) * scale);
-        else
-            zs_pipe_send_real (output, zs_pipe_real (input) * scale);
-    }
+    else
+        zs_pipe_send_whole (output, zs_pipe_whole (input) * scale);
 }
 #endif
 
@@ -41,7 +34,7 @@ static int
 s_Ki (zs_vm_t *self, zs_pipe_t *input, zs_pipe_t *output)
 {
     if (zs_vm_probing (self)) {
-        zs_vm_register (self, "Ki", zs_type_modest, "Scale by 2^10");
+        zs_vm_register_pure (self, "Ki", zs_type_modest, "Scale by 2^10");
     }
     else {
         //  Process all values on input pipe
@@ -56,7 +49,7 @@ static int
 s_Mi (zs_vm_t *self, zs_pipe_t *input, zs_pipe_t *output)
 {
     if (zs_vm_probing (self)) {
-        zs_vm_register (self, "Mi", zs_type_modest, "Scale by 2^20");
+        zs_vm_register_pure (self, "Mi", zs_type_modest, "Scale by 2^20");
     }
     else {
         //  Process all values on input pipe
@@ -71,7 +64,7 @@ static int
 s_Gi (zs_vm_t *self, zs_pipe_t *input, zs_pipe_t *output)
 {
     if (zs_vm_probing (self)) {
-        zs_vm_register (self, "Gi", zs_type_modest, "Scale by 2^30");
+        zs_vm_register_pure (self, "Gi", zs_type_modest, "Scale by 2^30");
     }
     else {
         //  Process all values on input pipe
@@ -86,7 +79,7 @@ static int
 s_Ti (zs_vm_t *self, zs_pipe_t *input, zs_pipe_t *output)
 {
     if (zs_vm_probing (self)) {
-        zs_vm_register (self, "Ti", zs_type_modest, "Scale by 2^40");
+        zs_vm_register_pure (self, "Ti", zs_type_modest, "Scale by 2^40");
     }
     else {
         //  Process all values on input pipe
@@ -101,7 +94,7 @@ static int
 s_Pi (zs_vm_t *self, zs_pipe_t *input, zs_pipe_t *output)
 {
     if (zs_vm_probing (self)) {
-        zs_vm_register (self, "Pi", zs_type_modest, "Scale by 2^50");
+        zs_vm_register_pure (self, "Pi", zs_type_modest, "Scale by 2^50");
     }
     else {
         //  Process all values on input pipe
@@ -116,7 +109,7 @@ static int
 s_Ei (zs_vm_t *self, zs_pipe_t *input, zs_pipe_t *output)
 {
     if (zs_vm_probing (self)) {
-        zs_vm_register (self, "Ei", zs_type_modest, "Scale by 2^60");
+        zs_vm_register_pure (self, "Ei", zs_type_modest, "Scale by 2^60");
     }
     else {
         //  Process all values on input pipe
@@ -131,7 +124,7 @@ static int
 s_da (zs_vm_t *self, zs_pipe_t *input, zs_pipe_t *output)
 {
     if (zs_vm_probing (self)) {
-        zs_vm_register (self, "da", zs_type_modest, "Scale by 10");
+        zs_vm_register_pure (self, "da", zs_type_modest, "Scale by 10");
     }
     else {
         //  Process all values on input pipe
@@ -146,7 +139,7 @@ static int
 s_h (zs_vm_t *self, zs_pipe_t *input, zs_pipe_t *output)
 {
     if (zs_vm_probing (self)) {
-        zs_vm_register (self, "h", zs_type_modest, "Scale by 100");
+        zs_vm_register_pure (self, "h", zs_type_modest, "Scale by 100");
     }
     else {
         //  Process all values on input pipe
@@ -161,7 +154,7 @@ static int
 s_k (zs_vm_t *self, zs_pipe_t *input, zs_pipe_t *output)
 {
     if (zs_vm_probing (self)) {
-        zs_vm_register (self, "k", zs_type_modest, "Scale by 1000");
+        zs_vm_register_pure (self, "k", zs_type_modest, "Scale by 1000");
     }
     else {
         //  Process all values on input pipe
@@ -176,7 +169,7 @@ static int
 s_M (zs_vm_t *self, zs_pipe_t *input, zs_pipe_t *output)
 {
     if (zs_vm_probing (self)) {
-        zs_vm_register (self, "M", zs_type_modest, "Scale by 10^6");
+        zs_vm_register_pure (self, "M", zs_type_modest, "Scale by 10^6");
     }
     else {
         //  Process all values on input pipe
@@ -191,7 +184,7 @@ static int
 s_G (zs_vm_t *self, zs_pipe_t *input, zs_pipe_t *output)
 {
     if (zs_vm_probing (self)) {
-        zs_vm_register (self, "G", zs_type_modest, "Scale by 10^9");
+        zs_vm_register_pure (self, "G", zs_type_modest, "Scale by 10^9");
     }
     else {
         //  Process all values on input pipe
@@ -206,7 +199,7 @@ static int
 s_T (zs_vm_t *self, zs_pipe_t *input, zs_pipe_t *output)
 {
     if (zs_vm_probing (self)) {
-        zs_vm_register (self, "T", zs_type_modest, "Scale by 10^12");
+        zs_vm_register_pure (self, "T", zs_type_modest, "Scale by 10^12");
     }
     else {
         //  Process all values on input pipe
@@ -221,7 +214,7 @@ static int
 s_P (zs_vm_t *self, zs_pipe_t *input, zs_pipe_t *output)
 {
     if (zs_vm_probing (self)) {
-        zs_vm_register (self, "P", zs_type_modest, "Scale by 10^15");
+        zs_vm_register_pure (self, "P", zs_type_modest, "Scale by 10^15");
     }
     else {
         //  Process all values on input pipe
@@ -236,7 +229,7 @@ static int
 s_E (zs_vm_t *self, zs_pipe_t *input, zs_pipe_t *output)
 {
     if (zs_vm_probing (self)) {
-        zs_vm_register (self, "E", zs_type_modest, "Scale by 10^18");
+        zs_vm_register_pure (self, "E", zs_type_modest, "Scale by 10^18");
     }
     else {
         //  Process all values on input pipe
@@ -251,7 +244,7 @@ static int
 s_Z (zs_vm_t *self, zs_pipe_t *input, zs_pipe_t *output)
 {
     if (zs_vm_probing (self)) {
-        zs_vm_register (self, "Z", zs_type_modest, "Scale by 10^21");
+        zs_vm_register_pure (self, "Z", zs_type_modest, "Scale by 10^21");
     }
     else {
         //  Process all values on input pipe
@@ -267,7 +260,7 @@ static int
 s_Y (zs_vm_t *self, zs_pipe_t *input, zs_pipe_t *output)
 {
     if (zs_vm_probing (self)) {
-        zs_vm_register (self, "Y", zs_type_modest, "Scale by 10^24");
+        zs_vm_register_pure (self, "Y", zs_type_modest, "Scale by 10^24");
     }
     else {
         //  Process all values on input pipe
@@ -283,7 +276,7 @@ static int
 s_d (zs_vm_t *self, zs_pipe_t *input, zs_pipe_t *output)
 {
     if (zs_vm_probing (self)) {
-        zs_vm_register (self, "d", zs_type_modest, "Scale by 1/10");
+        zs_vm_register_pure (self, "d", zs_type_modest, "Scale by 1/10");
     }
     else {
         //  Process all values on input pipe
@@ -299,7 +292,7 @@ static int
 s_c (zs_vm_t *self, zs_pipe_t *input, zs_pipe_t *output)
 {
     if (zs_vm_probing (self)) {
-        zs_vm_register (self, "c", zs_type_modest, "Scale by 1/100");
+        zs_vm_register_pure (self, "c", zs_type_modest, "Scale by 1/100");
     }
     else {
         //  Process all values on input pipe
@@ -315,7 +308,7 @@ static int
 s_m (zs_vm_t *self, zs_pipe_t *input, zs_pipe_t *output)
 {
     if (zs_vm_probing (self)) {
-        zs_vm_register (self, "m", zs_type_modest, "Scale by 1/1000");
+        zs_vm_register_pure (self, "m", zs_type_modest, "Scale by 1/1000");
     }
     else {
         //  Process all values on input pipe
@@ -331,7 +324,7 @@ static int
 s_u (zs_vm_t *self, zs_pipe_t *input, zs_pipe_t *output)
 {
     if (zs_vm_probing (self)) {
-        zs_vm_register (self, "u", zs_type_modest, "Scale by 1/10^6");
+        zs_vm_register_pure (self, "u", zs_type_modest, "Scale by 1/10^6");
     }
     else {
         //  Process all values on input pipe
@@ -347,7 +340,7 @@ static int
 s_n (zs_vm_t *self, zs_pipe_t *input, zs_pipe_t *output)
 {
     if (zs_vm_probing (self)) {
-        zs_vm_register (self, "n", zs_type_modest, "Scale by 1/10^9");
+        zs_vm_register_pure (self, "n", zs_type_modest, "Scale by 1/10^9");
     }
     else {
         //  Process all values on input pipe
@@ -363,7 +356,7 @@ static int
 s_p (zs_vm_t *self, zs_pipe_t *input, zs_pipe_t *output)
 {
     if (zs_vm_probing (self)) {
-        zs_vm_register (self, "p", zs_type_modest, "Scale by 1/10^12");
+        zs_vm_register_pure (self, "p", zs_type_modest, "Scale by 1/10^12");
     }
     else {
         //  Process all values on input pipe
@@ -379,7 +372,7 @@ static int
 s_f (zs_vm_t *self, zs_pipe_t *input, zs_pipe_t *output)
 {
     if (zs_vm_probing (self)) {
-        zs_vm_register (self, "f", zs_type_modest, "Scale by 1/10^15");
+        zs_vm_register_pure (self, "f", zs_type_modest, "Scale by 1/10^15");
     }
     else {
         //  Process all values on input pipe
@@ -395,7 +388,7 @@ static int
 s_a (zs_vm_t *self, zs_pipe_t *input, zs_pipe_t *output)
 {
     if (zs_vm_probing (self)) {
-        zs_vm_register (self, "a", zs_type_modest, "Scale by 1/10^18");
+        zs_vm_register_pure (self, "a", zs_type_modest, "Scale by 1/10^18");
     }
     else {
         //  Process all values on input pipe
@@ -411,7 +404,7 @@ static int
 s_z (zs_vm_t *self, zs_pipe_t *input, zs_pipe_t *output)
 {
     if (zs_vm_probing (self)) {
-        zs_vm_register (self, "z", zs_type_modest, "Scale by 1/10^21");
+        zs_vm_register_pure (self, "z", zs_type_modest, "Scale by 1/10^21");
     }
     else {
         //  Process all values on input pipe
@@ -427,7 +420,7 @@ static int
 s_y (zs_vm_t *self, zs_pipe_t *input, zs_pipe_t *output)
 {
     if (zs_vm_probing (self)) {
-        zs_vm_register (self, "y", zs_type_modest, "Scale by 1/10^24");
+        zs_vm_register_pure (self, "y", zs_type_modest, "Scale by 1/10^24");
     }
     else {
         //  Process all values on input pipe
@@ -21,12 +21,25 @@
     - constants are added to current output pipe
 
     Notes about the virtual machine:
-    - token threaded bytecode interpreter
-    - machine uses bytecodes with parameters following each opcode
+    - direct threaded interpreter
+    - compiler produces bytecodes with parameters following each opcode
+    - commit optimizes the bytecode of each function with a peephole pass
+    - calls to pure atomics over constants run once, at compile time, and
+      compile to their results, where we know the input pipe holds nothing
+      else: in a nest, or after emptying the input, or in a shell
+    - calls to small user functions compile to a copy of their body
+    - loop functions that register as counted loops, such as times,
+      count, and countdown, run natively, with their state in registers,
+      and the VM never calls them
+    - commit translates each function into threaded code: a stream of
+      words holding handler addresses, each followed by its operands
+        - every operand is a whole word, so nothing is decoded at run time
+        - calls and jumps hold the address of their target word
+        - dispatch uses computed goto where the compiler supports it, and
+          a switch everywhere else
     - 240-254 are built-in opcodes
         - essential to machine operation
-        - decoding costs must be minimized
-        - handled by if/switch in core interpreter
+        - decoded once, at commit time
         - can modify instruction pointer (needle)
     - 0..239 are class 0 atomics
         - no class name (short obvious names)
@@ -54,6 +67,7 @@
 #define MAX_NEST    256     //  Maximum nest () depth
 #define MAX_LOOP    256     //  Maximum loop {} depth
 #define MAX_CALLS   256     //  Maximum function call depth
+#define MAX_INLINE  48      //  Largest function body we inline, in bytes
 
 //  Bytecodes
 //  - up to 240 class 0 dictionary
@@ -73,6 +87,8 @@
 #define VM_STRING       246     //  Issue a string constant
 #define VM_PIPE         245     //  Execute pipe operation
 #define VM_SENTENCE     244     //  End sentence
+#define VM_COUNT        243     //  Open counted loop
+#define VM_XCOUNT       242     //  Close counted loop
 #define VM_GUARD        241     //  Assert if we ever reach this
 #define VM_STOP         240     //  Last built-in
 
@@ -87,11 +103,55 @@
 #define VM_PIPE_ARRAY   6       //  Prepare array function call
 #define VM_PIPE_UNLOOP  7       //  Prepare to call loop function
 #define VM_PIPE_MARK    8       //  End phrase
-
-static const char *
-pipe_op_name [] = {
-    "?", "NEST", "UNNEST", "SINGLE", "MODEST", "GREEDY", "ARRAY", "UNLOOP", "MARK"
-};
+#define VM_PIPE_CLEAR   9       //  Empty input pipe
+
+//  These are the counted loops that we run natively, rather than calling
+//  their loop function on each cycle; they follow the order of zs_loop_t
+#define VM_COUNT_TIMES  1       //  times {}: loop N times
+#define VM_COUNT_UP     2       //  count {}: issue index, counting up
+#define VM_COUNT_DOWN   3       //  countdown {}: issue N, counting down
+
+//  These are the threaded code operations, one per interpreter handler. The
+//  bytecode is translated into these at commit time; pipe operations become
+//  operations in their own right.
+#define OP_STOP         0       //  Stop the machine
+#define OP_ATOMIC       1       //  Call atomic; operand is atomic
+#define OP_CALL         2       //  Call user function; operand is target
+#define OP_RETURN       3       //  Return to previous needle
+#define OP_LOOP         4       //  Open loop; operand is target
+#define OP_XLOOP        5       //  Close loop; operand is target
+#define OP_JUMP         6       //  Jump; operand is target
+#define OP_JUMPEX       7       //  Jump if not positive; operand is target
+#define OP_WHOLE        8       //  Issue whole; operand is whole
+#define OP_REAL         9       //  Issue real; operand is real
+#define OP_STRING       10      //  Issue string; operand is string
+#define OP_NEST         11      //  Prepare nested argument list
+#define OP_UNNEST       12      //  Prepare nested function call
+#define OP_SINGLE       13      //  Pull single value from pipe
+#define OP_MODEST       14      //  Prepare modest function call
+#define OP_GREEDY       15      //  Prepare greedy function call
+#define OP_ARRAY        16      //  Prepare array function call
+#define OP_UNLOOP       17      //  Prepare to call loop function
+#define OP_MARK         18      //  End phrase
+#define OP_CLEAR        19      //  Empty input pipe
+#define OP_SENTENCE     20      //  End sentence
+#define OP_MODEST_CALL  21      //  MODEST + ATOMIC; operand is atomic
+#define OP_GREEDY_CALL  22      //  GREEDY + ATOMIC; operand is atomic
+#define OP_ARRAY_CALL   23      //  ARRAY + ATOMIC; operand is atomic
+#define OP_UNLOOP_CALL  24      //  UNLOOP + ATOMIC; operand is atomic
+#define OP_WHOLES       25      //  Issue wholes; operands are count, wholes
+#define OP_REALS        26      //  Issue reals; operands are count, reals
+#define OP_COUNT        27      //  Open counted loop; operands are target, kind
+#define OP_XCOUNT       28      //  Close counted loop; operand is target
+#define OP_LIMIT        29      //  Number of operations
+
+//  Pipe operations map onto consecutive threaded operations
+#define OP_PIPE(pipe_op)    (OP_NEST + (pipe_op) - VM_PIPE_NEST)
+
+//  Dispatch via computed goto when the compiler has labels as values
+#if defined (__GNUC__)
+#   define VM_THREADED
+#endif
 
 #include "zs_classes.h"
 
@@ -102,6 +162,8 @@ typedef struct {
     char *name;                     //  Primitive name
     char *hint;                     //  Hint to user
     zs_type_t type;                 //  Function type
+    bool pure;                      //  Depends only on its input
+    size_t counter;                 //  Counted loop we run natively, if any
 } s_atomic_t;
 
 static s_atomic_t *
@@ -127,6 +189,38 @@ s_atomic_destroy (s_atomic_t **self_p)
     }
 }
 
+//  Threaded code is an array of words. Each operation is one word, holding
+//  the address of its handler, or its number when we dispatch by switch, and
+//  each operand after it is one word.
+
+typedef union _word_t word_t;
+union _word_t {
+    const void *handler;            //  Handler address, if threaded
+    size_t opcode;                  //  Operation, if not threaded
+    s_atomic_t *atomic;             //  Atomic to call
+    word_t *target;                 //  Call or jump target
+    size_t address;                 //  Bytecode address, while translating
+    size_t count;                   //  Number of operands that follow
+    size_t kind;                    //  Kind of counted loop
+    int64_t whole;                  //  Whole number constant
+    double real;                    //  Real number constant
+    const char *string;             //  String constant, borrowed from code
+};
+
+//  Each counted loop keeps its state in registers, not in a pipe
+typedef struct {
+    size_t kind;                    //  Kind of counted loop
+    int64_t cycles;                 //  Cycles left after this one
+    int64_t index;                  //  Index to issue next
+    int64_t delta;                  //  Added to index each cycle
+} s_counter_t;
+
+//  Each committed function has its bytecode address and threaded entry
+typedef struct {
+    size_t address;                 //  Function guard in bytecode
+    word_t *entry;                  //  First word of function body
+} s_function_t;
+
 //  Structure of our class
 
 struct _zs_vm_t {
@@ -139,6 +233,17 @@ struct _zs_vm_t {
     size_t code_size;               //  Actual amount used
     size_t code_head;               //  Last defined function
     size_t checkpoint;              //  When defining a function
+    bool shell;                     //  Function being defined is a shell
+
+    //  Each function is translated into threaded code when committed, and
+    //  the interpreter only ever runs the threaded code
+    word_t *thread;                 //  Threaded code
+    size_t thread_max;              //  Allocated words
+    size_t thread_size;             //  Actual number of words used
+    s_function_t *functions;        //  Committed functions, oldest first
+    size_t nbr_functions;           //  Number of committed functions
+    const void **handlers;          //  Interpreter handlers, if threaded
+    byte *opcodes;                  //  Operation of each word, if threaded
 
     //  We use this during compile time to match start/end scopes
     size_t scope_stack [MAX_SCOPE]; //  Scope stack, arbitrary size
@@ -149,13 +254,23 @@ struct _zs_vm_t {
     size_t nest_stack_ptr;
 
     //  The loop stack holds input pipes during loop cycles
-    //  The indices table matches the stack and holds index values
     zs_pipe_t *loop_stack [MAX_LOOP];
-    size_t loop_indices [MAX_LOOP];
     size_t loop_stack_ptr;
 
+    //  The counter stack holds the state of counted loops
+    s_counter_t counter_stack [MAX_LOOP];
+    size_t counter_stack_ptr;
+
+    //  Spare pipes for nest and loop scopes; a scope takes a pipe from
+    //  the pool and gives it back, purged, so hot loops do not allocate
+    zs_pipe_t *pipe_pool [MAX_NEST + MAX_LOOP];
+    size_t pipe_pool_size;
+
+    //  All VM pipes allocate string values from this slab
+    zs_slab_t *slab;
+
     //  The call stack is used for actual function calls
-    size_t call_stack [MAX_CALLS];
+    word_t *call_stack [MAX_CALLS];
     size_t call_stack_ptr;
 
     zs_pipe_t *stdin;               //  Input to next function
@@ -164,6 +279,7 @@ struct _zs_vm_t {
     char *results;                  //  Sentence results, if any
     bool loop_fn;                   //  Call as loop function
 
+    word_t *resume;                 //  Where to resume after a switch
     bool verbose;                   //  Trace execution progress
     bool debug;                     //  Trace pipe states during execution
     size_t iterator;                //  For listing functions & atomics
@@ -193,6 +309,75 @@ s_function_name (zs_vm_t *self, size_t address)
         return "";
 }
 
+//  Decode 24-bit address from bytecode
+static size_t
+s_decode_address (byte *code)
+{
+    return (size_t) (code [0] << 16) + (size_t) (code [1] << 8) + (size_t) (code [2]);
+}
+
+//  Return the size in bytes of a bytecode instruction
+
+static size_t
+s_instruction_size (byte *instruction)
+{
+    switch (instruction [0]) {
+        case VM_CALL:
+        case VM_LOOP:
+        case VM_XLOOP:
+        case VM_JUMP:
+        case VM_JUMPEX:
+        case VM_XCOUNT:
+            return 4;
+        case VM_COUNT:
+            //  Target, then kind of loop
+            return 5;
+        case VM_WHOLE:
+            return 1 + sizeof (int64_t);
+        case VM_REAL:
+            return 1 + sizeof (double);
+        case VM_STRING: {
+            //  Length, then offset from operand to string
+            size_t length = (instruction [1] << 8) + instruction [2];
+            return 1 + instruction [3] + length + 1;
+        }
+        case VM_PIPE:
+            return 2;
+        default:
+            return 1;
+    }
+}
+
+//  Return true if a bytecode instruction is a jump
+
+static bool
+s_is_jump (byte *instruction)
+{
+    return instruction [0] == VM_LOOP || instruction [0] == VM_XLOOP
+        || instruction [0] == VM_JUMP || instruction [0] == VM_JUMPEX
+        || instruction [0] == VM_COUNT || instruction [0] == VM_XCOUNT;
+}
+
+//  Encode 24-bit address into bytecode
+
+static void
+s_encode_address (byte *code, size_t address)
+{
+    code [0] = (byte) (address >> 16);
+    code [1] = (byte) (address >> 8);
+    code [2] = (byte) (address);
+}
+
+//  Return true if the bytecode instruction at address is the pipe operation
+
+static bool
+s_is_pipe_op (zs_vm_t *self, size_t address, byte pipe_op)
+{
+    return address < self->code_size
+        && self->code [address] == VM_PIPE
+        && self->code [address + 1] == pipe_op;
+}
+
 //  Resolve function name to address, which is:
 //  1-253           - built in atomic, compiled as one byte
 //  254 + 3 bytes   - VM_CALL + 24-bit function address
@@ -227,11 +412,254 @@ s_resolve (zs_vm_t *self, const char *name)
 }
 
 
-//  Compile call to function, atomic, or built-in
+//  Send the constant at address to a pipe
+
+static void
+s_send_constant (zs_vm_t *self, size_t address, zs_pipe_t *pipe)
+{
+    byte *instruction = self->code + address;
+    if (instruction [0] == VM_WHOLE) {
+        int64_t whole;
+        memcpy (&whole, instruction + 1, sizeof (whole));
+        zs_pipe_send_whole (pipe, whole);
+    }
+    else
+    if (instruction [0] == VM_REAL) {
+        double real;
+        memcpy (&real, instruction + 1, sizeof (real));
+        zs_pipe_send_real (pipe, real);
+    }
+    else
+        zs_pipe_send_string (pipe, (char *) instruction + 1 + instruction [3]);
+}
+
+//  Return true if the input pipe is sure to be empty after the instruction
+//  at address, given whether it was empty before. Emptying the input does
+//  that; constants, marks, nests, and sentence ends leave the input as it
+//  was, and anything else may leave values in it.
+
+static bool
+s_input_empty_after (zs_vm_t *self, size_t address, bool empty)
+{
+    byte opcode = self->code [address];
+    if (s_is_pipe_op (self, address, VM_PIPE_CLEAR))
+        return true;
+    else
+    if (opcode == VM_WHOLE || opcode == VM_REAL || opcode == VM_STRING
+    ||  opcode == VM_SENTENCE
+    ||  s_is_pipe_op (self, address, VM_PIPE_MARK)
+    ||  s_is_pipe_op (self, address, VM_PIPE_NEST))
+        return empty;
+    else
+        return false;
+}
+
+//  Return true if the input pipe is sure to be empty at the end of the code.
+//  A shell starts with empty pipes, and other functions get whatever their
+//  caller left. Code that a jump lands in may run with other input; open
+//  menus and loops hold placeholders, which land beyond the code.
+
+static bool
+s_input_empty (zs_vm_t *self)
+{
+    assert (self->checkpoint);
+    size_t body = s_function_body (self, self->checkpoint);
+    bool *targets = (bool *) zmalloc (self->code_size - body + 1);
+    assert (targets);
+    size_t needle;
+    for (needle = body; needle < self->code_size; needle += s_instruction_size (self->code + needle))
+        if (s_is_jump (self->code + needle)) {
+            size_t target = s_decode_address (self->code + needle + 1);
+            if (target <= self->code_size)
+                targets [target - body] = true;
+        }
+    bool empty = self->shell;
+    for (needle = body; needle < self->code_size; needle += s_instruction_size (self->code + needle))
+        empty = s_input_empty_after (self, needle, empty && !targets [needle - body]);
+    empty = empty && !targets [self->code_size - body];
+    free (targets);
+    return empty;
+}
+
+//  Try to run a pure atomic at compile time, over the constants at the end
+//  of the code, and compile its output as constants in their place. We must
+//  know exactly what input the atomic gets:
+//  - unnesting gives it the nest, and drops the old input, which may hold
+//    values an earlier atomic left; a nest that we folded empties the
+//    input in place of unnesting, and that is as good as a constant here
+//  - other pipe operations add to the old input, so that must be empty,
+//    and the values they pull must all be constants: the last value for a
+//    modest pull, and the whole phrase for a greedy or array pull, which
+//    starts after a mark, a nest, or at the start of a shell
+//  Returns 0 if the call was folded, else -1.
+
+static int
+s_fold (zs_vm_t *self, s_atomic_t *atomic, byte pipe_op)
+{
+    if (pipe_op != VM_PIPE_UNNEST && pipe_op != VM_PIPE_MODEST
+    &&  pipe_op != VM_PIPE_GREEDY && pipe_op != VM_PIPE_ARRAY)
+        return -1;
+    assert (self->checkpoint);
+    size_t body = s_function_body (self, self->checkpoint);
+
+    //  Find the run of constants at the end of the code, the instruction
+    //  before them, if any, and the last constant
+    size_t start = body;            //  First constant
+    size_t previous = 0;            //  Instruction before run
+    size_t last = 0;                //  Last constant
+    size_t needle;
+    for (needle = body; needle < self->code_size; needle += s_instruction_size (self->code + needle)) {
+        byte opcode = self->code [needle];
+        if (opcode == VM_WHOLE || opcode == VM_REAL || opcode == VM_STRING)
+            last = needle;
+        else
+        if (!s_is_pipe_op (self, needle, VM_PIPE_CLEAR)) {
+            previous = needle;
+            start = needle + s_instruction_size (self->code + needle);
+        }
+    }
+    //  Code that a jump lands in may run with other input
+    size_t landing = 0;
+    for (needle = body; needle < self->code_size; needle += s_instruction_size (self->code + needle))
+        if (s_is_jump (self->code + needle)) {
+            size_t target = s_decode_address (self->code + needle + 1);
+            if (target <= self->code_size && target > landing)
+                landing = target;
+        }
+    if (start <= landing)
+        return -1;
+
+    //  We compile the output in place of the code from here on, and empty
+    //  the input first if that code did
+    size_t from = start;
+    bool clear = false;
+    zs_pipe_t *input = zs_pipe_new ();
+    if (pipe_op == VM_PIPE_UNNEST) {
+        if (!previous || !s_is_pipe_op (self, previous, VM_PIPE_NEST))
+            from = 0;
+        else {
+            from = previous;
+            clear = true;
+            for (needle = start; needle < self->code_size; needle += s_instruction_size (self->code + needle))
+                if (self->code [needle] != VM_PIPE)
+                    s_send_constant (self, needle, input);
+        }
+    }
+    else
+    if (last < start || last + s_instruction_size (self->code + last) < self->code_size
+    ||  !s_input_empty (self))
+        from = 0;
+    else
+    if (pipe_op == VM_PIPE_MODEST) {
+        from = last;
+        s_send_constant (self, last, input);
+    }
+    else {
+        //  Pull the phrase from a copy of the output, as the VM would
+        zs_pipe_t *phrase = zs_pipe_new ();
+        if (previous && s_is_pipe_op (self, previous, VM_PIPE_MARK)) {
+            from = previous;
+            zs_pipe_mark (phrase);
+        }
+        else
+        if (previous? !s_is_pipe_op (self, previous, VM_PIPE_NEST): !self->shell)
+            from = 0;
+        for (needle = start; needle < self->code_size; needle += s_instruction_size (self->code + needle))
+            if (self->code [needle] == VM_PIPE)
+                clear = true;
+            else
+                s_send_constant (self, needle, phrase);
+        if (pipe_op == VM_PIPE_GREEDY)
+            zs_pipe_pull_greedy (input, phrase);
+        else
+            zs_pipe_pull_array (input, phrase);
+        zs_pipe_destroy (&phrase);
+    }
+    zs_pipe_t *output = zs_pipe_new ();
+    int rc = -1;
+    if (from)
+        rc = (atomic->function) (self, input, output);
+
+    //  Values the atomic leaves would feed the next function, and we can
+    //  only compile wholes, reals, and strings
+    if (rc == 0 && zs_pipe_size (input) == 0
+    &&  zs_pipe_count (output, 'm') == 0 && zs_pipe_count (output, 'b') == 0) {
+        self->code_size = from;
+        if (clear) {
+            self->code [self->code_size++] = VM_PIPE;
+            self->code [self->code_size++] = VM_PIPE_CLEAR;
+        }
+        while (zs_pipe_recv (output)) {
+            if (zs_pipe_type (output) == 'w')
+                zs_vm_compile_whole (self, zs_pipe_whole (output));
+            else
+            if (zs_pipe_type (output) == 'r')
+                zs_vm_compile_real (self, zs_pipe_real (output));
+            else
+                zs_vm_compile_string (self, zs_pipe_string (output));
+        }
+    }
+    else
+        rc = -1;
+    zs_pipe_destroy (&input);
+    zs_pipe_destroy (&output);
+    return rc;
+}
+
+//  Copy the body of a small user function into the code, in place of a
+//  call to it. User functions do not touch the pipes, so the copy works
+//  just as the call would, without the call and return. Jumps in the body
+//  are relocated, and string constants compiled again, to keep their
+//  alignment. Returns 0 if the function was inlined, or -1 if its body is
+//  too large.
+
+static int
+s_inline (zs_vm_t *self, size_t address)
+{
+    size_t body = s_function_body (self, address);
+    size_t limit = body;
+    while (self->code [limit] != VM_RETURN)
+        limit += s_instruction_size (self->code + limit);
+    if (limit - body > MAX_INLINE)
+        return -1;
+
+    size_t *moved = (size_t *) malloc ((limit - body + 1) * sizeof (size_t));
+    assert (moved);
+    size_t start = self->code_size;
+    size_t needle;
+    for (needle = body; needle < limit; needle += s_instruction_size (self->code + needle)) {
+        byte *instruction = self->code + needle;
+        moved [needle - body] = self->code_size;
+        if (instruction [0] == VM_STRING)
+            zs_vm_compile_string (self, (char *) instruction + 1 + instruction [3]);
+        else {
+            memcpy (self->code + self->code_size, instruction, s_instruction_size (instruction));
+            self->code_size += s_instruction_size (instruction);
+        }
+    }
+    //  A jump may land just past the body, where its return was
+    moved [limit - body] = self->code_size;
+    for (needle = start; needle < self->code_size; needle += s_instruction_size (self->code + needle))
+        if (s_is_jump (self->code + needle)) {
+            size_t target = s_decode_address (self->code + needle + 1);
+            assert (target >= body && target <= limit);
+            s_encode_address (self->code + needle + 1, moved [target - body]);
+        }
+    free (moved);
+    return 0;
+}
+
+//  Compile call to function, atomic, or built-in; calls to pure atomics
+//  over constants run at compile time, and calls to small user functions
+//  compile to their body, if possible
 
 static void
 s_compile_call (zs_vm_t *self, size_t address, byte pipe_op)
 {
+    if (address < self->nbr_atomics && self->atomics [address]->pure
+    &&  s_fold (self, self->atomics [address], pipe_op) == 0)
+        return;
+
     //  A non-zero pipe_op means we muck with the plumbing
     if (pipe_op) {
         self->code [self->code_size++] = VM_PIPE;
@@ -239,7 +667,8 @@ s_compile_call (zs_vm_t *self, size_t address, byte pipe_op)
     }
     if (address < 256)
         self->code [self->code_size++] = (byte) address;
-    else {
+    else
+    if (s_inline (self, address & 0xFFFFFF) == -1) {
         //  Store 4 bytes from high to low
         self->code [self->code_size++] = (byte) (address >> 24);
         self->code [self->code_size++] = (byte) (address >> 16);
@@ -249,6 +678,390 @@ s_compile_call (zs_vm_t *self, size_t address, byte pipe_op)
     }
 }
 
+//  Take a pipe from the pool, or create a new one if the pool is empty
+
+static zs_pipe_t *
+s_pipe_acquire (zs_vm_t *self)
+{
+    if (self->pipe_pool_size)
+        return self->pipe_pool [--self->pipe_pool_size];
+
+    zs_pipe_t *pipe = zs_pipe_new ();
+    zs_pipe_set_slab (pipe, self->slab);
+    return pipe;
+}
+
+//  Give a pipe back to the pool, empty, for reuse by a later scope
+
+static void
+s_pipe_release (zs_vm_t *self, zs_pipe_t **pipe_p)
+{
+    zs_pipe_purge (*pipe_p);
+    if (self->pipe_pool_size < MAX_NEST + MAX_LOOP) {
+        self->pipe_pool [self->pipe_pool_size++] = *pipe_p;
+        *pipe_p = NULL;
+    }
+    else
+        zs_pipe_destroy (pipe_p);
+}
+
+static int
+    s_interpret (zs_vm_t *self, word_t *needle);
+
+//  Append a threaded operation to the threaded code
+
+static void
+s_emit (zs_vm_t *self, size_t opcode)
+{
+    assert (self->thread_size < self->thread_max);
+#if defined (VM_THREADED)
+    //  The traced interpreter looks up each operation by its word
+    self->opcodes [self->thread_size] = (byte) opcode;
+    self->thread [self->thread_size++].handler = self->handlers [opcode];
+#else
+    self->thread [self->thread_size++].opcode = opcode;
+#endif
+}
+
+//  Append an operand word to the threaded code, and return it for the
+//  caller to fill in
+
+static word_t *
+s_emit_operand (zs_vm_t *self)
+{
+    assert (self->thread_size < self->thread_max);
+    return self->thread + self->thread_size++;
+}
+
+//  Return threaded entry of the committed function at the specified address.
+//  Address zero, which is not a function, maps to the initial STOP.
+
+static word_t *
+s_function_entry (zs_vm_t *self, size_t address)
+{
+    size_t index = self->nbr_functions;
+    while (index--)
+        if (self->functions [index].address == address)
+            return self->functions [index].entry;
+    assert (address == 0);
+    return self->thread;
+}
+
+//  If the code ends in a call to a function that registered as one of the
+//  counted loops we run natively, after its pipe operation, returns the
+//  kind of loop, else returns 0.
+
+static size_t
+s_counter_kind (zs_vm_t *self, size_t address)
+{
+    if (address >= self->nbr_atomics || !self->checkpoint)
+        return 0;
+    size_t kind = self->atomics [address]->counter;
+
+    //  Find the last two instructions, so we don't mistake an operand for
+    //  the call
+    size_t needle = s_function_body (self, self->checkpoint);
+    size_t previous = 0;
+    size_t last = 0;
+    while (needle < self->code_size) {
+        previous = last;
+        last = needle;
+        needle += s_instruction_size (self->code + needle);
+    }
+    if (kind && last == self->code_size - 1 && self->code [last] == address
+    &&  (s_is_pipe_op (self, previous, VM_PIPE_MODEST)
+    ||   s_is_pipe_op (self, previous, VM_PIPE_UNNEST))
+    &&  previous + 2 == last)
+        return kind;
+    else
+        return 0;
+}
+
+//  Optimize the function at the specified address, which ends at the end of
+//  the code, by rewriting its bytecode:
+//  - a jump to an unconditional jump goes straight to the final target
+//  - an unconditional jump to the next instruction goes
+//  - in a run of phrase marks before a greedy pull, only the last mark
+//    counts, as the pull takes the whole sentence and drops all marks
+//  - an empty nest comes down to emptying the input pipe
+//  - a menu whose selector is a whole constant either always runs, so we
+//    drop the test, or never runs, so we drop the menu; this only works
+//    where the input pipe is sure to be empty, as the menu tests the
+//    front of the input, which may hold values an earlier atomic left
+//  The rewritten code keeps its jumps; we never drop code that a jump from
+//  elsewhere lands in.
+
+static void
+s_optimize (zs_vm_t *self, size_t address)
+{
+    size_t body = s_function_body (self, address);
+    size_t limit = self->code_size;
+    size_t size = limit - body;
+    bool *targets = (bool *) zmalloc (size);
+    bool *dead = (bool *) zmalloc (size);
+    assert (targets && dead);
+    size_t nbr_dead = 0;
+
+    //  Thread jumps to jumps, and note where every jump lands
+    size_t needle, next;
+    for (needle = body; needle < limit; needle += s_instruction_size (self->code + needle))
+        if (s_is_jump (self->code + needle)) {
+            size_t target = s_decode_address (self->code + needle + 1);
+            size_t hops = 0;
+            while (self->code [target] == VM_JUMP && hops++ < size)
+                target = s_decode_address (self->code + target + 1);
+            s_encode_address (self->code + needle + 1, target);
+            assert (target >= body && target < limit);
+            targets [target - body] = true;
+        }
+
+    bool empty = self->shell;       //  Input pipe is sure to be empty
+    size_t dropped = 0;             //  Exit of a menu we dropped
+    for (needle = body; needle < limit; needle = next) {
+        next = needle + s_instruction_size (self->code + needle);
+        if (dead [needle - body])
+            continue;
+        empty = empty && (!targets [needle - body] || needle == dropped);
+        if (self->code [needle] == VM_JUMP
+        &&  s_decode_address (self->code + needle + 1) == next) {
+            dead [needle - body] = true;
+            nbr_dead++;
+        }
+        else
+        if (s_is_pipe_op (self, needle, VM_PIPE_MARK)
+        &&  s_is_pipe_op (self, next, VM_PIPE_MARK)) {
+            size_t pull = next;
+            while (s_is_pipe_op (self, pull, VM_PIPE_MARK))
+                pull += 2;
+            if (s_is_pipe_op (self, pull, VM_PIPE_GREEDY)) {
+                dead [needle - body] = true;
+                nbr_dead++;
+            }
+        }
+        else
+        if (s_is_pipe_op (self, needle, VM_PIPE_NEST)
+        &&  s_is_pipe_op (self, next, VM_PIPE_UNNEST)
+        &&  !targets [next - body]) {
+            dead [needle - body] = true;
+            nbr_dead++;
+            self->code [next + 1] = VM_PIPE_CLEAR;
+        }
+        else
+        if (empty && self->code [needle] == VM_WHOLE
+        &&  s_is_pipe_op (self, next, VM_PIPE_SINGLE)
+        &&  self->code [next + 2] == VM_JUMPEX
+        &&  !targets [next - body] && !targets [next + 2 - body]) {
+            //  The single pull takes the constant as selector, which is
+            //  then all the input
+            int64_t selector;
+            memcpy (&selector, self->code + needle + 1, sizeof (selector));
+            size_t exit = s_decode_address (self->code + next + 3);
+            size_t scan;
+            if (selector > 0)
+                exit = next + 6;    //  Drop just the test
+            else {
+                //  Keep the menu if any jump from outside lands inside;
+                //  else the input is still empty at the exit, unless a
+                //  jump from outside lands there too
+                bool inside = false;
+                bool landed = false;
+                for (scan = body; scan < limit; scan += s_instruction_size (self->code + scan))
+                    if ((scan < needle || scan >= exit) && s_is_jump (self->code + scan)) {
+                        size_t target = s_decode_address (self->code + scan + 1);
+                        if (target > needle && target < exit)
+                            inside = true;
+                        if (target == exit)
+                            landed = true;
+                    }
+                if (inside)
+                    exit = needle;
+                else
+                if (!landed)
+                    dropped = exit;
+            }
+            for (scan = needle; scan < exit; scan += s_instruction_size (self->code + scan))
+                if (!dead [scan - body]) {
+                    dead [scan - body] = true;
+                    nbr_dead++;
+                }
+        }
+        empty = s_input_empty_after (self, needle, empty);
+    }
+    if (nbr_dead) {
+        //  Copy the live code back into place, from a copy of the old code,
+        //  noting where each instruction moved to; string constants must
+        //  be compiled again, to keep their alignment
+        byte *copy = (byte *) malloc (size);
+        size_t *moved = (size_t *) malloc (size * sizeof (size_t));
+        assert (copy && moved);
+        memcpy (copy, self->code + body, size);
+        self->code_size = body;
+        size_t offset;
+        for (offset = 0; offset < size; offset = next) {
+            byte *instruction = copy + offset;
+            next = offset + s_instruction_size (instruction);
+            moved [offset] = self->code_size;
+            if (dead [offset])
+                continue;
+            if (instruction [0] == VM_STRING)
+                zs_vm_compile_string (self, (char *) instruction + 1 + instruction [3]);
+            else {
+                memcpy (self->code + self->code_size, instruction, next - offset);
+                self->code_size += next - offset;
+            }
+        }
+        //  Relocate jumps; nothing jumps into dropped code, except to its
+        //  start, which moves to the next live instruction
+        for (needle = body; needle < self->code_size; needle += s_instruction_size (self->code + needle))
+            if (s_is_jump (self->code + needle)) {
+                size_t target = s_decode_address (self->code + needle + 1);
+                s_encode_address (self->code + needle + 1, moved [target - body]);
+            }
+        free (copy);
+        free (moved);
+    }
+    free (targets);
+    free (dead);
+}
+
+//  Translate the function at the specified address, which ends at the end of
+//  the code, into threaded code. Jumps stay within their function, so we
+//  note where each instruction lands and resolve the jumps at the end.
+//
+//  Where an atomic call follows its pipe operation, or constants of one
+//  type follow each other, we emit one fused operation (a superinstruction)
+//  for the lot, so long as no jump lands inside.
+
+static void
+s_translate (zs_vm_t *self, size_t address)
+{
+    size_t body = s_function_body (self, address);
+    size_t limit = self->code_size;
+    word_t **landing = (word_t **) malloc ((limit - body) * sizeof (word_t *));
+    word_t **jumps = (word_t **) malloc ((limit - body) * sizeof (word_t *));
+    bool *targets = (bool *) zmalloc (limit - body);
+    assert (landing && jumps && targets);
+    size_t nbr_jumps = 0;
+
+    self->functions = (s_function_t *) realloc (self->functions,
+        (self->nbr_functions + 1) * sizeof (s_function_t));
+    assert (self->functions);
+    self->functions [self->nbr_functions].address = address;
+    self->functions [self->nbr_functions].entry = self->thread + self->thread_size;
+
+    //  Find all jump targets first, as we must not fuse across them
+    size_t needle;
+    for (needle = body; needle < limit; needle += s_instruction_size (self->code + needle))
+        if (s_is_jump (self->code + needle)) {
+            size_t target = s_decode_address (self->code + needle + 1);
+            assert (target >= body && target < limit);
+            targets [target - body] = true;
+        }
+
+    needle = body;
+    while (needle < limit) {
+        landing [needle - body] = self->thread + self->thread_size;
+        byte opcode = self->code [needle];
+        size_t next = needle + s_instruction_size (self->code + needle);
+        bool fusable = next < limit && !targets [next - body];
+        switch (opcode) {
+            case VM_CALL:
+                s_emit (self, OP_CALL);
+                s_emit_operand (self)->target =
+                    s_function_entry (self, s_decode_address (self->code + needle + 1));
+                break;
+            case VM_RETURN:
+                s_emit (self, OP_RETURN);
+                break;
+            case VM_LOOP:
+            case VM_XLOOP:
+            case VM_JUMP:
+            case VM_JUMPEX:
+            case VM_COUNT:
+            case VM_XCOUNT:
+                //  Resolve the target once we've translated it
+                s_emit (self, opcode == VM_LOOP? OP_LOOP:
+                              opcode == VM_XLOOP? OP_XLOOP:
+                              opcode == VM_JUMP? OP_JUMP:
+                              opcode == VM_JUMPEX? OP_JUMPEX:
+                              opcode == VM_COUNT? OP_COUNT: OP_XCOUNT);
+                jumps [nbr_jumps] = s_emit_operand (self);
+                jumps [nbr_jumps++]->address = s_decode_address (self->code + needle + 1);
+                if (opcode == VM_COUNT)
+                    s_emit_operand (self)->kind = self->code [needle + 4];
+                break;
+            case VM_WHOLE:
+            case VM_REAL: {
+                //  Count the run of constants that we can issue together
+                size_t count = 1;
+                while (fusable && self->code [next] == opcode) {
+                    count++;
+                    next += s_instruction_size (self->code + next);
+                    fusable = next < limit && !targets [next - body];
+                }
+                if (count > 1) {
+                    s_emit (self, opcode == VM_WHOLE? OP_WHOLES: OP_REALS);
+                    s_emit_operand (self)->count = count;
+                }
+                else
+                    s_emit (self, opcode == VM_WHOLE? OP_WHOLE: OP_REAL);
+                //  Wholes and reals are both 8 bytes, one word each
+                for (; needle < next; needle += s_instruction_size (self->code + needle))
+                    memcpy (s_emit_operand (self), self->code + needle + 1, 8);
+                break;
+            }
+            case VM_STRING: {
+                size_t length = (self->code [needle + 1] << 8) + self->code [needle + 2];
+                s_emit (self, OP_STRING);
+                s_emit_operand (self)->string =
+                    (const char *) self->code + next - length - 1;
+                break;
+            }
+            case VM_PIPE: {
+                byte pipe_op = self->code [needle + 1];
+                if (fusable && self->code [next] < 240
+                && (pipe_op == VM_PIPE_MODEST || pipe_op == VM_PIPE_GREEDY
+                ||  pipe_op == VM_PIPE_ARRAY  || pipe_op == VM_PIPE_UNLOOP)) {
+                    //  Fuse pipe operation with the atomic that follows
+                    s_emit (self, pipe_op == VM_PIPE_MODEST? OP_MODEST_CALL:
+                                  pipe_op == VM_PIPE_GREEDY? OP_GREEDY_CALL:
+                                  pipe_op == VM_PIPE_ARRAY? OP_ARRAY_CALL: OP_UNLOOP_CALL);
+                    assert (self->code [next] < self->nbr_atomics);
+                    s_emit_operand (self)->atomic = self->atomics [self->code [next]];
+                    next++;
+                }
+                else
+                    s_emit (self, OP_PIPE (pipe_op));
+                break;
+            }
+            case VM_SENTENCE:
+                s_emit (self, OP_SENTENCE);
+                break;
+            case VM_STOP:
+                s_emit (self, OP_STOP);
+                break;
+            default:
+                //  Anything else must be a class 0 atomic
+                if (opcode >= 240 || opcode >= self->nbr_atomics) {
+                    printf ("E: corrupt VM, opcode=%d\n", opcode);
+                    assert (false);
+                }
+                s_emit (self, OP_ATOMIC);
+                s_emit_operand (self)->atomic = self->atomics [opcode];
+                break;
+        }
+        needle = next;
+    }
+    while (nbr_jumps) {
+        word_t *jump = jumps [--nbr_jumps];
+        jump->target = landing [jump->address - body];
+    }
+    self->nbr_functions++;
+    free (landing);
+    free (jumps);
+    free (targets);
+}
+
 //  Registered as atomic zero, so if we ever try to execute an opcode zero, we
 //  come here and kill the machine.
 
@@ -274,12 +1087,24 @@ zs_vm_new (void)
 {
     zs_vm_t *self = (zs_vm_t *) zmalloc (sizeof (zs_vm_t));
     if (self) {
-        self->stdin = zs_pipe_new ();
-        self->stdout = zs_pipe_new ();
-        self->loopin = zs_pipe_new ();
+        self->slab = zs_slab_new ();
+        self->stdin = s_pipe_acquire (self);
+        self->stdout = s_pipe_acquire (self);
+        self->loopin = s_pipe_acquire (self);
         self->code_max = 32000;         //  Arbitrary; TODO: extensible
         self->code = (byte *) malloc (self->code_max);
         self->code [self->code_size++] = VM_STOP;
+        //  An atomic is one byte of code and two words of threaded code,
+        //  the most we ever translate a byte into
+        self->thread_max = self->code_max * 2;
+        //  Runs of constants are arrays of words, so words must match
+        assert (sizeof (word_t) == sizeof (int64_t));
+        self->thread = (word_t *) malloc (self->thread_max * sizeof (word_t));
+#if defined (VM_THREADED)
+        self->opcodes = (byte *) malloc (self->thread_max);
+#endif
+        s_interpret (self, NULL);
+        s_emit (self, OP_STOP);
         zs_vm_probe (self, s_halt_error);
     }
     return self;
@@ -299,9 +1124,15 @@ zs_vm_destroy (zs_vm_t **self_p)
         zs_pipe_destroy (&self->stdin);
         zs_pipe_destroy (&self->stdout);
         zs_pipe_destroy (&self->loopin);
+        while (self->pipe_pool_size)
+            zs_pipe_destroy (&self->pipe_pool [--self->pipe_pool_size]);
+        zs_slab_destroy (&self->slab);
         while (self->nbr_atomics)
             s_atomic_destroy (&self->atomics [--self->nbr_atomics]);
         free (self->code);
+        free (self->thread);
+        free (self->opcodes);
+        free (self->functions);
         free (self);
         *self_p = NULL;
     }
@@ -353,6 +1184,36 @@ zs_vm_register (zs_vm_t *self, const char *name, zs_type_t type, const char *hin
 }
 
 
+//  ---------------------------------------------------------------------------
+//  Primitive registers itself as a pure function, as for zs_vm_register. A
+//  pure function has no side effects, and its output depends only on its
+//  input. The compiler may then run it at compile time, when its input is
+//  all constants, and compile its output instead of the call.
+
+int
+zs_vm_register_pure (zs_vm_t *self, const char *name, zs_type_t type, const char *hint)
+{
+    int rc = zs_vm_register (self, name, type, hint);
+    self->atomics [self->nbr_atomics - 1]->pure = true;
+    return rc;
+}
+
+
+//  ---------------------------------------------------------------------------
+//  Primitive registers itself as a counted loop function, as for
+//  zs_vm_register, with modest type. The VM runs such loops natively, with
+//  their state in registers, and does not call the function on each cycle,
+//  so the function must do exactly what the VM does for its kind of loop.
+
+int
+zs_vm_register_loop (zs_vm_t *self, const char *name, zs_loop_t loop, const char *hint)
+{
+    int rc = zs_vm_register (self, name, zs_type_modest, hint);
+    self->atomics [self->nbr_atomics - 1]->counter = VM_COUNT_TIMES + loop - zs_loop_times;
+    return rc;
+}
+
+
 //  ---------------------------------------------------------------------------
 //  Compile a whole number constant into the virtual machine.
 //  Whole numbers are stored thus:
@@ -384,14 +1245,26 @@ zs_vm_compile_real (zs_vm_t *self, double real)
 //  ---------------------------------------------------------------------------
 //  Compile a string constant into the virtual machine.
 //  Strings are stored thus:
-//      [VM_STRING][null-terminated string]
+//      [VM_STRING][length, hi/lo 2 bytes][offset to string, 1 byte]
+//      [padding][pipe constant header][null-terminated string]
+//  The string is a pipe constant, which pipes borrow rather than copy, so
+//  running the code does not copy the string.
 
 void
 zs_vm_compile_string (zs_vm_t *self, const char *string)
 {
+    size_t length = strlen (string);
+    assert (length <= 0xFFFF);
     self->code [self->code_size++] = VM_STRING;
-    strcpy ((char *) self->code + self->code_size, string);
-    self->code_size += strlen (string) + 1;
+    size_t operand = self->code_size;
+    self->code [operand] = (byte) (length >> 8);
+    self->code [operand + 1] = (byte) (length & 0xFF);
+    //  The constant must be aligned to 8 bytes in the bytecode
+    size_t start = (operand + 3 + 7) & ~(size_t) 7;
+    const char *constant = zs_pipe_constant_new (self->code + start, string, length);
+    size_t offset = (const byte *) constant - self->code;
+    self->code [operand + 2] = (byte) (offset - operand);
+    self->code_size = offset + length + 1;
 }
 
 
@@ -418,6 +1291,22 @@ zs_vm_compile_define (zs_vm_t *self, const char *name)
     //  Store function name and bump code size
     strcpy ((char *) self->code + self->code_size, name);
     self->code_size += strlen (name) + 1;
+    self->shell = false;
+}
+
+
+//  ---------------------------------------------------------------------------
+//  Compile a new shell definition; end with a commit. A shell is a function
+//  that the caller runs on its own and then rolls back, as the REPL does with
+//  each command; no other function may call it. As each run starts with
+//  clean pipes, the compiler knows more about the shell's input, and can run
+//  more of it at compile time.
+
+void
+zs_vm_compile_shell (zs_vm_t *self, const char *name)
+{
+    zs_vm_compile_define (self, name);
+    self->shell = true;
 }
 
 
@@ -431,7 +1320,10 @@ zs_vm_commit (zs_vm_t *self)
     assert (self->checkpoint);
     //  End function with a RETURN operation
     self->code [self->code_size++] = VM_RETURN;
-    //  The function is now successfully compiled in the bytecode
+    //  The function is now successfully compiled in the bytecode, and we
+    //  optimize it, and translate it into threaded code, ready to run
+    s_optimize (self, self->checkpoint);
+    s_translate (self, self->checkpoint);
     self->code_head = self->checkpoint;
     self->checkpoint = 0;
 }
@@ -447,6 +1339,17 @@ zs_vm_commit (zs_vm_t *self)
 int
 zs_vm_rollback (zs_vm_t *self)
 {
+    //  Pipes may still hold string constants from the code we're about to
+    //  drop, e.g. results not yet collected; give them their own copies
+    zs_pipe_materialize (self->stdin);
+    zs_pipe_materialize (self->stdout);
+    zs_pipe_materialize (self->loopin);
+    size_t index;
+    for (index = 0; index < self->nest_stack_ptr; index++)
+        zs_pipe_materialize (self->nest_stack [index]);
+    for (index = 0; index < self->loop_stack_ptr; index++)
+        zs_pipe_materialize (self->loop_stack [index]);
+
     int rc = 0;
     if (self->checkpoint) {
         self->code_size = self->checkpoint;
@@ -460,6 +1363,11 @@ zs_vm_rollback (zs_vm_t *self)
         assert (address >= offset);
         self->code_head = address - offset;
         self->code_size = address;
+        //  Drop its threaded code, which is also the last
+        assert (self->nbr_functions);
+        self->nbr_functions--;
+        assert (self->functions [self->nbr_functions].address == address);
+        self->thread_size = self->functions [self->nbr_functions].entry - self->thread;
     }
     else
         rc = -1;
@@ -534,7 +1442,8 @@ zs_vm_compile_xnest (zs_vm_t *self)
 //  ---------------------------------------------------------------------------
 //  Compiles a loop. Caller must provide name of function, which has just run
 //  and left its output on stdout: loop event, and then loop state, either as
-//  one value or as a phrase.
+//  one value or as a phrase. The built-in counted loops, times, count, and
+//  countdown, run natively instead, and do not call their loop function.
 
 int
 zs_vm_compile_loop (zs_vm_t *self, const char *name)
@@ -553,12 +1462,21 @@ zs_vm_compile_loop (zs_vm_t *self, const char *name)
     //
     //   - push loop_address for xloop so it can fill in the blanks
     //   - use a magic value A5A5A5 to double-check this code
+    //
+    //  A counted loop replaces the call to its loop function:
+    //  - take loop arguments from stdin, as the loop function would
+    //  - jump to address if no cycles, else stack loop state
+    size_t kind = s_counter_kind (self, fn_address);
+    if (kind)
+        self->code_size--;      //  Drop the call, keep its pipe operation
     assert (self->scope_stack_ptr < MAX_SCOPE);
     self->scope_stack [self->scope_stack_ptr++] = self->code_size + 1;
-    self->code [self->code_size++] = VM_LOOP;
+    self->code [self->code_size++] = kind? VM_COUNT: VM_LOOP;
     self->code [self->code_size++] = 0xA5;
     self->code [self->code_size++] = 0xA5;
     self->code [self->code_size++] = 0xA5;
+    if (kind)
+        self->code [self->code_size++] = (byte) kind;
 
     //  Push function address to scope stack for xloop
     assert (self->scope_stack_ptr < MAX_SCOPE);
@@ -580,6 +1498,9 @@ zs_vm_compile_loop (zs_vm_t *self, const char *name)
 //  - recv whole event from loopin
 //  - jump to address if event > 0
 //    ... continue
+//
+//  A counted loop counts down its cycles, and jumps to address if any are
+//  left, else unstacks its state.
 
 void
 zs_vm_compile_xloop (zs_vm_t *self)
@@ -596,11 +1517,16 @@ zs_vm_compile_xloop (zs_vm_t *self)
     assert (self->scope_stack_ptr);
     size_t loop_address = self->scope_stack [--self->scope_stack_ptr];
 
-    //  VM: execute loop function with unloop pipe semantics
-    s_compile_call (self, fn_address, VM_PIPE_UNLOOP);
+    if (self->code [loop_address - 1] == VM_COUNT)
+        //  VM: count cycle and jump to body if any left
+        self->code [self->code_size++] = VM_XCOUNT;
+    else {
+        //  VM: execute loop function with unloop pipe semantics
+        s_compile_call (self, fn_address, VM_PIPE_UNLOOP);
 
-    //  VM: evaluate loop event and jump to body if positive
-    self->code [self->code_size++] = VM_XLOOP;
+        //  VM: evaluate loop event and jump to body if positive
+        self->code [self->code_size++] = VM_XLOOP;
+    }
     self->code [self->code_size++] = (byte) (body_address >> 16);
     self->code [self->code_size++] = (byte) (body_address >> 8);
     self->code [self->code_size++] = (byte) (body_address);
@@ -740,7 +1666,8 @@ zs_vm_function_next (zs_vm_t *self)
 
 
 //  ---------------------------------------------------------------------------
-//  Enable tracing of VM compilation and execution.
+//  Enable tracing of VM compilation and execution. Execution is traced by
+//  a separate interpreter, so untraced runs do not pay for tracing.
 
 void
 zs_vm_set_verbose (zs_vm_t *self, bool verbose)
@@ -770,235 +1697,120 @@ zs_vm_loop_state (zs_vm_t *self)
 }
 
 
-//  ---------------------------------------------------------------------------
-//  Run last defined function, if any, in the VM. This continues forever or
-//  until the function ends. Returns 0 if stopped successfully, or -1 if
-//  stopped due to some error. Each run of the VM starts with clean pipes.
+//  Run one cycle of a counted loop: issue its index, if it has one, and
+//  count the cycle
+
+static inline void
+s_counter_cycle (zs_vm_t *self, s_counter_t *counter)
+{
+    if (counter->kind == VM_COUNT_UP) {
+        zs_pipe_send_whole (self->stdout, counter->index);
+        counter->index += counter->delta;
+    }
+    else
+    if (counter->kind == VM_COUNT_DOWN)
+        zs_pipe_send_whole (self->stdout, counter->cycles);
+    counter->cycles--;
+}
+
+//  Trace the interpreter state before each operation
+
+static void
+s_trace (zs_vm_t *self, word_t *needle)
+{
+    if (self->debug) {
+        zs_pipe_print (self->stdin, "Stdin:   ");
+        zs_pipe_print (self->stdout, "Stdout:  ");
+        zs_pipe_print (self->loopin, "Loopin:  ");
+    }
+    printf ("D [%04zd]: ", needle - self->thread);
+}
+
+//  Return name of the function with the specified threaded entry, for
+//  tracing
+
+static const char *
+s_entry_name (zs_vm_t *self, word_t *entry)
+{
+    size_t index = self->nbr_functions;
+    while (index--)
+        if (self->functions [index].entry == entry)
+            return s_function_name (self, self->functions [index].address);
+    return "";
+}
+
+//  Return the operation of the threaded word at the needle. The traced
+//  interpreter uses this to dispatch code threaded for the untraced one.
 
 static size_t
-s_decode_address (byte *code)
+s_opcode (zs_vm_t *self, word_t *needle)
 {
-    return (size_t) (code [0] << 16) + (size_t) (code [1] << 8) + (size_t) (code [2]);
+#if defined (VM_THREADED)
+    return self->opcodes [needle - self->thread];
+#else
+    return needle->opcode;
+#endif
 }
 
+//  Build the interpreter without tracing, and with tracing
+#define VM_INTERPRET    s_interpret
+#define VM_TRACING      0
+#include "zs_vm_interpret.h"
+
+#define VM_INTERPRET    s_interpret_traced
+#define VM_TRACING      1
+#include "zs_vm_interpret.h"
+
+
+//  ---------------------------------------------------------------------------
+//  Run last defined function, if any, in the VM. This continues forever or
+//  until the function ends. Returns 0 if stopped successfully, or -1 if
+//  stopped due to some error. Each run of the VM starts with clean pipes.
 
 int
 zs_vm_run (zs_vm_t *self)
 {
     assert (!self->checkpoint);
-//     static size_t quota = 250;
 
     //  We call the last function that was defined, which is at code_head.
-    //  When this function returns, the VM ends at needle = 0, and stops.
-    assert (self->code [0] == VM_STOP);
-    size_t needle = s_function_body (self, self->code_head);
-    self->call_stack [0] = 0;
+    //  When this function returns, the VM ends at the initial STOP.
+    word_t *needle = s_function_entry (self, self->code_head);
+    self->call_stack [0] = self->thread;
     self->call_stack_ptr = 1;
 
     if (self->verbose)
-        printf ("D [%04zd]: run '%s'\n", needle, s_function_name (self, self->code_head));
-
-    //  Clean pipes before each run
+        printf ("D [%04zd]: run '%s'\n",
+                needle - self->thread, s_function_name (self, self->code_head));
+
+    //  Clean pipes before each run, including any left stacked by a run
+    //  that failed, and then reset the slab, which all strings came from
+    while (self->nest_stack_ptr) {
+        s_pipe_release (self, &self->stdout);
+        self->stdout = self->nest_stack [--self->nest_stack_ptr];
+    }
+    while (self->loop_stack_ptr) {
+        s_pipe_release (self, &self->loopin);
+        self->loopin = self->loop_stack [--self->loop_stack_ptr];
+    }
+    self->counter_stack_ptr = 0;
     zs_pipe_purge (self->stdin);
     zs_pipe_purge (self->stdout);
     zs_pipe_purge (self->loopin);
+    //  Only VM pipes hold strings from the slab, and they're all empty
+    //  now, so the reset must work; a failed reset means a leak
+    if (zs_slab_reset (self->slab)) {
+        printf ("E: %zd strings outlived their run\n", zs_slab_used (self->slab));
+        assert (false);
+    }
 
     //  Run virtual machine until stopped or interrupted
-    while (!zctx_interrupted) {
-//         if (--quota == 0) {
-//             puts ("EXPIRED");
-//             break;
-//         }
-        if (self->debug) {
-            zs_pipe_print (self->stdin, "Stdin:   ");
-            zs_pipe_print (self->stdout, "Stdout:  ");
-            zs_pipe_print (self->loopin, "Loopin:  ");
-        }
-        if (self->verbose)
-            printf ("D [%04zd]: ", needle);
-        byte opcode = self->code [needle++];
-        if (opcode < 240) {
-            if (self->verbose)
-                printf ("atomic=%s\n", self->atomics [opcode]->name);
-            if ((self->atomics [opcode]->function) (self,
-                self->loop_fn? self->loopin: self->stdin,
-                self->stdout))
-                break;
-            self->loop_fn = false;
-        }
-        else
-        if (opcode == VM_CALL) {
-            //  Address is in next 3 bytes
-            size_t address = s_decode_address (self->code + needle);
-            needle += 3;
-            assert (self->code [address] == VM_GUARD);
-            if (self->verbose)
-                printf ("CALL function=%s address=%zd stack=%zd\n",
-                        s_function_name (self, address), address, self->call_stack_ptr);
-            assert (self->call_stack_ptr < MAX_CALLS);
-            self->call_stack [self->call_stack_ptr++] = needle;
-            needle = s_function_body (self, address);
-        }
-        else
-        if (opcode == VM_RETURN) {
-            if (self->verbose)
-                printf ("RETURN stack=%zd\n", self->call_stack_ptr);
-            needle = self->call_stack [--self->call_stack_ptr];
-        }
-        else
-        if (opcode == VM_LOOP) {
-            //  - stack loopin, create new loopin
-            //  - pipe op GREEDY (stdout -> loopin)
-            //  - recv event from loopin (state remains on loopin)
-            //  - jump to address if event <= 0
-            self->loop_stack [self->loop_stack_ptr++] = self->loopin;
-            self->loopin = zs_pipe_new ();
-            //  Get last phrase into loopin pipe
-            zs_pipe_pull_greedy (self->loopin, self->stdout);
-            //  Get event and jump if false
-            int64_t event = zs_pipe_recv_whole (self->loopin);
-            if (self->verbose)
-                printf ("LOOP event=%" PRId64 "\n", event);
-            if (event > 0)
-                needle += 3;        //  Skip jump address
-            else {
-                needle = s_decode_address (self->code + needle);
-            }
-        }
-        else
-        if (opcode == VM_XLOOP) {
-            //  - pipe op GREEDY (stdout -> loopin)
-            //  - recv event from loopin
-            //  - jump to address if event > 0
-            //  - destroy loopin and pop saved loopin
-            //  Get last phrase into loopin pipe
-            zs_pipe_pull_greedy (self->loopin, self->stdout);
-            //  Get event and jump if true
-            int64_t event = zs_pipe_recv_whole (self->loopin);
-            if (self->verbose)
-                printf ("XLOOP event=%" PRId64 "\n", event);
-            if (event > 0) {
-                needle = s_decode_address (self->code + needle);
-            }
-            else {
-                needle += 3;        //  Skip jump address
-                //  Restore previous loopin pipe
-                assert (self->loop_stack_ptr > 0);
-                zs_pipe_destroy (&self->loopin);
-                self->loopin = self->loop_stack [--self->loop_stack_ptr];
-            }
-        }
-        else
-        if (opcode == VM_JUMP) {
-            //  Jump unconditionally
-            needle = s_decode_address (self->code + needle);
-            if (self->verbose)
-                printf ("JUMP address=%zd\n", needle);
-        }
-        else
-        if (opcode == VM_JUMPEX) {
-            //  We expect test value on input pipe
-            int64_t event = zs_pipe_recv_whole (self->stdin);
-            if (self->verbose)
-                printf ("JUMPEX event=%" PRId64 "\n", event);
-            //  Jump if next input value is zero or negative
-            if (event > 0)
-                needle += 3;        //  Skip jump address
-            else
-                needle = s_decode_address (self->code + needle);
-        }
-        else
-        if (opcode == VM_WHOLE) {
-            int64_t whole;
-            memcpy (&whole, self->code + needle, sizeof (whole));
-            zs_pipe_send_whole (self->stdout, whole);
-            if (self->verbose)
-                printf ("WHOLE value=%" PRId64 "\n", whole);
-            needle += sizeof (whole);
-        }
-        else
-        if (opcode == VM_REAL) {
-            double real;
-            memcpy (&real, self->code + needle, sizeof (real));
-            zs_pipe_send_real (self->stdout, real);
-            if (self->verbose)
-                printf ("REAL value=%g\n", real);
-            needle += sizeof (real);
-        }
-        else
-        if (opcode == VM_STRING) {
-            char *string = (char *) self->code + needle;
-            zs_pipe_send_string (self->stdout, string);
-            if (self->verbose)
-                printf ("STRING value=%s\n", string);
-            needle += strlen (string) + 1;
-        }
-        else
-        if (opcode == VM_PIPE) {
-            //  Later we'll rewrite the pipe API to use fixed allocations inside
-            //  the VM. The current design makes it easy to develop the language.
-            byte pipe_op = self->code [needle++];
-            if (self->verbose)
-                printf ("PIPE op=%s\n", pipe_op_name [pipe_op]);
-
-            switch (pipe_op) {
-                case VM_PIPE_NEST:
-                    assert (self->nest_stack_ptr < MAX_NEST);
-                    self->nest_stack [self->nest_stack_ptr++] = self->stdout;
-                    self->stdout = zs_pipe_new ();
-                    break;
-                case VM_PIPE_UNNEST:
-                    assert (self->nest_stack_ptr > 0);
-                    zs_pipe_destroy (&self->stdin);
-                    self->stdin = self->stdout;
-                    self->stdout = self->nest_stack [--self->nest_stack_ptr];
-                    break;
-                case VM_PIPE_SINGLE:
-                    zs_pipe_pull_single (self->stdin, self->stdout);
-                    break;
-                case VM_PIPE_MODEST:
-                    zs_pipe_pull_modest (self->stdin, self->stdout);
-                    break;
-                case VM_PIPE_GREEDY:
-                    zs_pipe_pull_greedy (self->stdin, self->stdout);
-                    break;
-                case VM_PIPE_ARRAY:
-                    zs_pipe_pull_array (self->stdin, self->stdout);
-                    break;
-                case VM_PIPE_UNLOOP:
-                    self->loop_fn = true;
-                    break;
-                case VM_PIPE_MARK:
-                    zs_pipe_mark (self->stdout);
-                    break;
-            }
-        }
-        else
-        if (opcode == VM_SENTENCE) {
-            if (self->verbose)
-                printf ("SENTENCE\n");
-            //  TODO: send results to console/actor pipe
-            //  For now zs_repl grabs results via the zs_vm_results call
-        }
-        else
-        if (opcode == VM_GUARD) {
-            if (self->verbose)
-                printf ("GUARD\n");
-            printf ("E: corrupt VM, aborting\n");
-            assert (false);
-        }
-        else
-        if (opcode == VM_STOP) {
-            if (self->verbose)
-                printf ("STOP\n");
-            break;
-        }
-        else {
-            printf ("ERROR opcode=%d\n", opcode);
-            break;
-        }
-    }
-    return 0;
+    if (zctx_interrupted)
+        return 0;
+    int rc;
+    while ((rc = self->verbose? s_interpret_traced (self, needle):
+                                s_interpret (self, needle)) > 0)
+        needle = self->resume;
+    return rc;
 }
 
 
@@ -1016,6 +1828,18 @@ zs_vm_results (zs_vm_t *self)
 }
 
 
+//  ---------------------------------------------------------------------------
+//  Write results to a file descriptor, after successful execution, without
+//  holding them in memory. Returns the number of bytes written, or -1 if
+//  there was an error writing to the file descriptor.
+
+int64_t
+zs_vm_results_fd (zs_vm_t *self, int fd)
+{
+    return zs_pipe_paste_fd (self->stdout, fd);
+}
+
+
 //  ---------------------------------------------------------------------------
 //  Selftest
 
@@ -1024,7 +1848,7 @@ static int
 s_sum (zs_vm_t *self, zs_pipe_t *input, zs_pipe_t *output)
 {
     if (zs_vm_probing (self))
-        zs_vm_register (self, "sum", zs_type_greedy, "Add up all the values");
+        zs_vm_register_pure (self, "sum", zs_type_greedy, "Add up all the values");
     else {
         int64_t sum = 0;
         while (zs_pipe_recv (input))
@@ -1077,8 +1901,10 @@ s_year (zs_vm_t *self, zs_pipe_t *input, zs_pipe_t *output)
 static int
 s_times (zs_vm_t *self, zs_pipe_t *input, zs_pipe_t *output)
 {
-    if (zs_vm_probing (self))
+    if (zs_vm_probing (self)) {
         zs_vm_register (self, "times", zs_type_modest, "Loop N times");
+        zs_vm_register_loop (self, "repeat", zs_loop_times, "Loop N times, natively");
+    }
     else {
         zs_pipe_mark (output);
         int64_t value = zs_pipe_recv_whole (input);
@@ -1095,6 +1921,28 @@ s_times (zs_vm_t *self, zs_pipe_t *input, zs_pipe_t *output)
     return 0;
 }
 
+static int
+s_k (zs_vm_t *self, zs_pipe_t *input, zs_pipe_t *output)
+{
+    if (zs_vm_probing (self))
+        zs_vm_register_pure (self, "k", zs_type_modest, "Scale by 1000");
+    else
+        while (zs_pipe_recv (input))
+            zs_pipe_send_whole (output, zs_pipe_whole (input) * 1000);
+    return 0;
+}
+
+static int
+s_minutes (zs_vm_t *self, zs_pipe_t *input, zs_pipe_t *output)
+{
+    if (zs_vm_probing (self))
+        zs_vm_register_pure (self, "minutes", zs_type_modest, "Scale by seconds per minute");
+    else
+        while (zs_pipe_recv (input))
+            zs_pipe_send_whole (output, zs_pipe_whole (input) * 60);
+    return 0;
+}
+
 
 void
 zs_vm_test (bool verbose)
@@ -1112,6 +1960,8 @@ zs_vm_test (bool verbose)
     zs_vm_probe (vm, s_assert);
     zs_vm_probe (vm, s_year);
     zs_vm_probe (vm, s_times);
+    zs_vm_probe (vm, s_k);
+    zs_vm_probe (vm, s_minutes);
 
     //  --------------------------------------------------------------------
     //  sub: (<OK> <Guys> tally 2 assert)
@@ -1196,6 +2046,7 @@ zs_vm_test (bool verbose)
 
     //  --------------------------------------------------------------------
     //  loop: (3 times { <hello> } tally 3 assert )
+    //  This times is a plain loop function, which the VM calls each cycle
 
     zs_vm_compile_define (vm, "loop");
     zs_vm_compile_whole  (vm, 3);
@@ -1229,6 +2080,194 @@ zs_vm_test (bool verbose)
     }
     assert (nbr_functions == 5);
 
+    //  String results outlive the code that produced them
+    zs_vm_compile_define (vm, "hello");
+    zs_vm_compile_string (vm, "Hello, World");
+    zs_vm_compile_sentence (vm);
+    zs_vm_commit (vm);
+    zs_vm_run (vm);
+    zs_vm_rollback (vm);
+    zs_vm_compile_define (vm, "overwrite");
+    zs_vm_compile_string (vm, "Goodbye, Cruel World");
+    zs_vm_commit (vm);
+    assert (streq (zs_vm_results (vm), "Hello, World"));
+    zs_vm_rollback (vm);
+    //  Nest and loop scopes gave their pipes back for reuse
+    assert (vm->pipe_pool_size > 0);
+    size_t thread_size;
+
+    //  Pure atomics over a nest of constants run at compile time
+    //  folded: (sum (1 sum (2 3)))
+    thread_size = vm->thread_size;
+    zs_vm_compile_define (vm, "folded");
+    zs_vm_compile_nest   (vm, "sum");
+    zs_vm_compile_whole  (vm, 1);
+    zs_vm_compile_nest   (vm, "sum");
+    zs_vm_compile_whole  (vm, 2);
+    zs_vm_compile_whole  (vm, 3);
+    zs_vm_compile_xnest  (vm);
+    zs_vm_compile_xnest  (vm);
+    zs_vm_commit (vm);
+    //  CLEAR WHOLE <6> RETURN
+    assert (vm->thread_size - thread_size == 4);
+    zs_vm_run (vm);
+    assert (streq (zs_vm_results (vm), "6"));
+    zs_vm_rollback (vm);
+
+    //  Small user functions compile to their body, not to a call
+    //  pair: (1 2)
+    //  pairs: (pair pair)
+    zs_vm_compile_define (vm, "pair");
+    zs_vm_compile_whole  (vm, 1);
+    zs_vm_compile_whole  (vm, 2);
+    zs_vm_commit (vm);
+    thread_size = vm->thread_size;
+    zs_vm_compile_define (vm, "pairs");
+    zs_vm_compile_inline (vm, "pair");
+    zs_vm_compile_inline (vm, "pair");
+    zs_vm_commit (vm);
+    //  WHOLES 4 <1> <2> <1> <2> RETURN
+    assert (vm->thread_size - thread_size == 7);
+    zs_vm_run (vm);
+    assert (streq (zs_vm_results (vm), "1 2 1 2"));
+    zs_vm_rollback (vm);
+    zs_vm_rollback (vm);
+
+    //  A menu tests the front of the input, which may hold values that an
+    //  earlier atomic left, rather than its constant selector
+    //  leftover: (1 1 0 assert 1 [ <never> ])
+    zs_vm_compile_define (vm, "leftover");
+    zs_vm_compile_whole  (vm, 1);
+    zs_vm_compile_whole  (vm, 1);
+    zs_vm_compile_whole  (vm, 0);
+    zs_vm_compile_inline (vm, "assert");
+    zs_vm_compile_whole  (vm, 1);
+    zs_vm_compile_menu   (vm);
+    zs_vm_compile_string (vm, "never");
+    zs_vm_compile_xmenu  (vm);
+    zs_vm_commit (vm);
+    zs_vm_run (vm);
+    assert (streq (zs_vm_results (vm), ""));
+    zs_vm_rollback (vm);
+
+    //  In a shell, constant menus fold away, with any code that can never
+    //  run
+    //  $shell$: (0 [ <never> 1 [ <nested> ] ] 1 [ <always> ])
+    thread_size = vm->thread_size;
+    zs_vm_compile_shell  (vm, "$shell$");
+    zs_vm_compile_whole  (vm, 0);
+    zs_vm_compile_menu   (vm);
+    zs_vm_compile_string (vm, "never");
+    zs_vm_compile_whole  (vm, 1);
+    zs_vm_compile_menu   (vm);
+    zs_vm_compile_string (vm, "nested");
+    zs_vm_compile_xmenu  (vm);
+    zs_vm_compile_xmenu  (vm);
+    zs_vm_compile_whole  (vm, 1);
+    zs_vm_compile_menu   (vm);
+    zs_vm_compile_string (vm, "always");
+    zs_vm_compile_xmenu  (vm);
+    zs_vm_commit (vm);
+    //  STRING <always> RETURN
+    assert (vm->thread_size - thread_size == 3);
+    zs_vm_run (vm);
+    assert (streq (zs_vm_results (vm), "always"));
+    zs_vm_rollback (vm);
+
+    //  So do menus after emptying the input, in any function
+    //  cleared: (sum (1) 1 [ <always> ])
+    thread_size = vm->thread_size;
+    zs_vm_compile_define (vm, "cleared");
+    zs_vm_compile_nest   (vm, "sum");
+    zs_vm_compile_whole  (vm, 1);
+    zs_vm_compile_xnest  (vm);
+    zs_vm_compile_whole  (vm, 1);
+    zs_vm_compile_menu   (vm);
+    zs_vm_compile_string (vm, "always");
+    zs_vm_compile_xmenu  (vm);
+    zs_vm_commit (vm);
+    //  CLEAR WHOLE <1> STRING <always> RETURN
+    assert (vm->thread_size - thread_size == 6);
+    zs_vm_run (vm);
+    assert (streq (zs_vm_results (vm), "1 always"));
+    zs_vm_rollback (vm);
+
+    //  A loop function that registered as a counted loop runs natively,
+    //  without the loop and unloop calls around each cycle
+    //  looped: (3 times { <hello> } tally)
+    //  counted: (3 repeat { <hello> } tally)
+    thread_size = vm->thread_size;
+    zs_vm_compile_define (vm, "looped");
+    zs_vm_compile_whole  (vm, 3);
+    zs_vm_compile_inline (vm, "times");
+    zs_vm_compile_loop   (vm, "times");
+    zs_vm_compile_string (vm, "hello");
+    zs_vm_compile_xloop  (vm);
+    zs_vm_compile_inline (vm, "tally");
+    zs_vm_commit (vm);
+    //  WHOLE <3> MODEST_CALL <times> LOOP <end> STRING <hello>
+    //  UNLOOP_CALL <times> XLOOP <body> GREEDY_CALL <tally> RETURN
+    assert (vm->thread_size - thread_size == 15);
+    zs_vm_run (vm);
+    assert (streq (zs_vm_results (vm), "3"));
+    zs_vm_rollback (vm);
+
+    thread_size = vm->thread_size;
+    zs_vm_compile_define (vm, "counted");
+    zs_vm_compile_whole  (vm, 3);
+    zs_vm_compile_inline (vm, "repeat");
+    zs_vm_compile_loop   (vm, "repeat");
+    zs_vm_compile_string (vm, "hello");
+    zs_vm_compile_xloop  (vm);
+    zs_vm_compile_inline (vm, "tally");
+    zs_vm_commit (vm);
+    //  WHOLE <3> MODEST COUNT <end> <kind> STRING <hello>
+    //  XCOUNT <body> GREEDY_CALL <tally> RETURN
+    assert (vm->thread_size - thread_size == 13);
+    zs_vm_run (vm);
+    assert (streq (zs_vm_results (vm), "3"));
+    zs_vm_rollback (vm);
+
+    //  A shell starts with empty pipes, so pure atomics over constants run
+    //  at compile time, whatever the pull
+    //  $shell$: (1 k, 5 minutes, 1 2 sum)
+    thread_size = vm->thread_size;
+    zs_vm_compile_shell  (vm, "$shell$");
+    zs_vm_compile_whole  (vm, 1);
+    zs_vm_compile_inline (vm, "k");
+    zs_vm_compile_phrase (vm);
+    zs_vm_compile_whole  (vm, 5);
+    zs_vm_compile_inline (vm, "minutes");
+    zs_vm_compile_phrase (vm);
+    zs_vm_compile_whole  (vm, 1);
+    zs_vm_compile_whole  (vm, 2);
+    zs_vm_compile_inline (vm, "sum");
+    zs_vm_commit (vm);
+    //  The sum takes its phrase and the mark before it
+    //  WHOLE <1000> MARK WHOLES 2 <300> <3> RETURN
+    assert (vm->thread_size - thread_size == 8);
+    zs_vm_run (vm);
+    assert (streq (zs_vm_results (vm), "1000, 300 3"));
+    zs_vm_rollback (vm);
+
+    //  Other functions may get leftovers as input, so only a pull after
+    //  emptying the input is safe
+    //  scale: (1 k sum (2) k)
+    thread_size = vm->thread_size;
+    zs_vm_compile_define (vm, "scale");
+    zs_vm_compile_whole  (vm, 1);
+    zs_vm_compile_inline (vm, "k");
+    zs_vm_compile_nest   (vm, "sum");
+    zs_vm_compile_whole  (vm, 2);
+    zs_vm_compile_xnest  (vm);
+    zs_vm_compile_inline (vm, "k");
+    zs_vm_commit (vm);
+    //  WHOLE <1> MODEST_CALL <k> CLEAR WHOLE <2000> RETURN
+    assert (vm->thread_size - thread_size == 8);
+    zs_vm_run (vm);
+    assert (streq (zs_vm_results (vm), "1000 2000"));
+    zs_vm_rollback (vm);
+
     zs_vm_destroy (&vm);
     //  @end
     printf ("OK\n");
@@ -43,6 +43,19 @@ typedef enum {
 } zs_type_t;
 
 
+//  Counted loops, which the VM runs natively; the order matches the VM's
+//  own loop codes
+typedef enum {
+    //  times {}: loop N times
+    zs_loop_times,
+    //  count {}: issue an index on each cycle, counting up from 1 by 1, or
+    //  from and by optional further inputs
+    zs_loop_count,
+    //  countdown {}: issue N, N - 1, and so on down to 1
+    zs_loop_countdown
+} zs_loop_t;
+
+
 //  Virtual machine atomic function type
 typedef int (zs_vm_fn_t) (zs_vm_t *self, zs_pipe_t *input, zs_pipe_t *output);
 
@@ -75,6 +88,20 @@ bool
 int
     zs_vm_register (zs_vm_t *self, const char *name, zs_type_t type, const char *hint);
 
+//  Primitive registers itself as a pure function, as for zs_vm_register. A
+//  pure function has no side effects, and its output depends only on its
+//  input. The compiler may then run it at compile time, when its input is
+//  all constants, and compile its output instead of the call.
+int
+    zs_vm_register_pure (zs_vm_t *self, const char *name, zs_type_t type, const char *hint);
+
+//  Primitive registers itself as a counted loop function, as for
+//  zs_vm_register, with modest type. The VM runs such loops natively, with
+//  their state in registers, and does not call the function on each cycle,
+//  so the function must do exactly what the VM does for its kind of loop.
+int
+    zs_vm_register_loop (zs_vm_t *self, const char *name, zs_loop_t loop, const char *hint);
+
 //  Compile a whole number constant into the virtual machine.
 //  Whole numbers are stored thus:
 //      [VM_WHOLE][8 bytes in host format]
@@ -95,6 +122,14 @@ void
 void
     zs_vm_compile_define (zs_vm_t *self, const char *name);
 
+//  Compile a new shell definition; end with a commit. A shell is a function
+//  that the caller runs on its own and then rolls back, as the REPL does with
+//  each command; no other function may call it. As each run starts with
+//  clean pipes, the compiler knows more about the shell's input, and can run
+//  more of it at compile time.
+void
+    zs_vm_compile_shell (zs_vm_t *self, const char *name);
+
 //  Close the current function definition.
 void
     zs_vm_commit (zs_vm_t *self);
@@ -165,7 +200,8 @@ const char *
 const char *
     zs_vm_function_next (zs_vm_t *self);
 
-//  Enable tracing of VM compilation and execution.
+//  Enable tracing of VM compilation and execution. Execution is traced by
+//  a separate interpreter, so untraced runs do not pay for tracing.
 void
     zs_vm_set_verbose (zs_vm_t *self, bool verbose);
 
@@ -188,6 +224,12 @@ int
 const char *
     zs_vm_results (zs_vm_t *self);
 
+//  Write results to a file descriptor, after successful execution, without
+//  holding them in memory. Returns the number of bytes written, or -1 if
+//  there was an error writing to the file descriptor.
+int64_t
+    zs_vm_results_fd (zs_vm_t *self, int fd);
+
 //  Self test of this class
 void
     zs_vm_test (bool animate);
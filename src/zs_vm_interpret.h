@@ -0,0 +1,401 @@
+/*  =========================================================================
+    zs_vm_interpret - ZeroScript virtual machine interpreter
+
+    Copyright (c) the Contributors as noted in the AUTHORS file.
+    This file is part of the ZeroScript language, http://zeroscript.org.
+
+    This Source Code Form is subject to the terms of the Mozilla Public
+    License, v. 2.0. If a copy of the MPL was not distributed with this
+    file, You can obtain one at http://mozilla.org/MPL/2.0/.
+    =========================================================================
+*/
+
+/*
+    The interpreter runs threaded code from the specified needle until the
+    machine stops or an atomic fails, and returns 0 if stopped, or -1 if an
+    atomic failed. If an atomic switches tracing on or off, it returns 1,
+    and the other interpreter resumes at self->resume.
+
+    zs_vm.c includes this file twice, to build the interpreter twice from
+    the same source. Before each include, it defines VM_INTERPRET as the
+    name of the function to build, and VM_TRACING as 1 to build it with
+    tracing, else 0. The untraced interpreter is what normally runs, and
+    costs nothing for tracing. It also provides the handlers for threaded
+    code, if called with a NULL needle. The traced interpreter runs when
+    the VM is verbose, and dispatches the same threaded code by looking up
+    each operation.
+*/
+
+//  Each handler is a label if we're threaded, else a case in a switch.
+//  Handlers end by dispatching the next operation.
+#if defined (VM_THREADED)
+#   define VM_HANDLER(op)   op_##op:
+#   if VM_TRACING
+#       define VM_NEXT      do { s_trace (self, needle); \
+                                 goto *handlers [s_opcode (self, needle++)]; \
+                            } while (0)
+#   else
+#       define VM_NEXT      goto *(needle++)->handler
+#   endif
+#else
+#   define VM_HANDLER(op)   case OP_##op:
+#   define VM_NEXT          continue
+#endif
+
+//  Call an atomic, and hand over to the other interpreter if the atomic
+//  switched tracing on or off
+#define VM_CALL_ATOMIC(atomic) \
+    do { \
+        if (((atomic)->function) (self, \
+            self->loop_fn? self->loopin: self->stdin, \
+            self->stdout)) \
+            return -1; \
+        self->loop_fn = false; \
+        if (self->verbose != VM_TRACING) { \
+            self->resume = needle; \
+            return 1; \
+        } \
+    } while (0)
+
+static int
+VM_INTERPRET (zs_vm_t *self, word_t *needle)
+{
+#if defined (VM_THREADED)
+    static const void *handlers [OP_LIMIT] = {
+        [OP_STOP] = &&op_STOP,
+        [OP_ATOMIC] = &&op_ATOMIC,
+        [OP_CALL] = &&op_CALL,
+        [OP_RETURN] = &&op_RETURN,
+        [OP_LOOP] = &&op_LOOP,
+        [OP_XLOOP] = &&op_XLOOP,
+        [OP_JUMP] = &&op_JUMP,
+        [OP_JUMPEX] = &&op_JUMPEX,
+        [OP_WHOLE] = &&op_WHOLE,
+        [OP_REAL] = &&op_REAL,
+        [OP_STRING] = &&op_STRING,
+        [OP_NEST] = &&op_NEST,
+        [OP_UNNEST] = &&op_UNNEST,
+        [OP_SINGLE] = &&op_SINGLE,
+        [OP_MODEST] = &&op_MODEST,
+        [OP_GREEDY] = &&op_GREEDY,
+        [OP_ARRAY] = &&op_ARRAY,
+        [OP_UNLOOP] = &&op_UNLOOP,
+        [OP_MARK] = &&op_MARK,
+        [OP_CLEAR] = &&op_CLEAR,
+        [OP_SENTENCE] = &&op_SENTENCE,
+        [OP_MODEST_CALL] = &&op_MODEST_CALL,
+        [OP_GREEDY_CALL] = &&op_GREEDY_CALL,
+        [OP_ARRAY_CALL] = &&op_ARRAY_CALL,
+        [OP_UNLOOP_CALL] = &&op_UNLOOP_CALL,
+        [OP_WHOLES] = &&op_WHOLES,
+        [OP_REALS] = &&op_REALS,
+        [OP_COUNT] = &&op_COUNT,
+        [OP_XCOUNT] = &&op_XCOUNT
+    };
+#   if !VM_TRACING
+    if (!needle) {
+        self->handlers = handlers;
+        return 0;
+    }
+#   endif
+    VM_NEXT;
+#else
+    if (!needle)
+        return 0;
+    while (true) {
+    if (VM_TRACING)
+        s_trace (self, needle);
+    switch (s_opcode (self, needle++)) {
+#endif
+    VM_HANDLER (ATOMIC) {
+        s_atomic_t *atomic = (needle++)->atomic;
+        if (VM_TRACING)
+            printf ("atomic=%s\n", atomic->name);
+        VM_CALL_ATOMIC (atomic);
+        VM_NEXT;
+    }
+    VM_HANDLER (MODEST_CALL) {
+        s_atomic_t *atomic = (needle++)->atomic;
+        if (VM_TRACING)
+            printf ("PIPE op=MODEST atomic=%s\n", atomic->name);
+        zs_pipe_pull_modest (self->stdin, self->stdout);
+        VM_CALL_ATOMIC (atomic);
+        VM_NEXT;
+    }
+    VM_HANDLER (GREEDY_CALL) {
+        s_atomic_t *atomic = (needle++)->atomic;
+        if (VM_TRACING)
+            printf ("PIPE op=GREEDY atomic=%s\n", atomic->name);
+        zs_pipe_pull_greedy (self->stdin, self->stdout);
+        VM_CALL_ATOMIC (atomic);
+        VM_NEXT;
+    }
+    VM_HANDLER (ARRAY_CALL) {
+        s_atomic_t *atomic = (needle++)->atomic;
+        if (VM_TRACING)
+            printf ("PIPE op=ARRAY atomic=%s\n", atomic->name);
+        zs_pipe_pull_array (self->stdin, self->stdout);
+        VM_CALL_ATOMIC (atomic);
+        VM_NEXT;
+    }
+    VM_HANDLER (UNLOOP_CALL) {
+        s_atomic_t *atomic = (needle++)->atomic;
+        if (VM_TRACING)
+            printf ("PIPE op=UNLOOP atomic=%s\n", atomic->name);
+        self->loop_fn = true;
+        VM_CALL_ATOMIC (atomic);
+        VM_NEXT;
+    }
+    VM_HANDLER (CALL) {
+        //  Check for interrupts on each call and each loop cycle, which
+        //  is enough to catch any script that runs away
+        if (zctx_interrupted)
+            return 0;
+        word_t *target = (needle++)->target;
+        if (VM_TRACING)
+            printf ("CALL function=%s address=%zd stack=%zd\n",
+                    s_entry_name (self, target), target - self->thread,
+                    self->call_stack_ptr);
+        assert (self->call_stack_ptr < MAX_CALLS);
+        self->call_stack [self->call_stack_ptr++] = needle;
+        needle = target;
+        VM_NEXT;
+    }
+    VM_HANDLER (RETURN) {
+        if (VM_TRACING)
+            printf ("RETURN stack=%zd\n", self->call_stack_ptr);
+        needle = self->call_stack [--self->call_stack_ptr];
+        VM_NEXT;
+    }
+    VM_HANDLER (LOOP) {
+        //  - stack loopin, create new loopin
+        //  - pipe op GREEDY (stdout -> loopin)
+        //  - recv event from loopin (state remains on loopin)
+        //  - jump to address if event <= 0
+        assert (self->loop_stack_ptr < MAX_LOOP);
+        self->loop_stack [self->loop_stack_ptr++] = self->loopin;
+        self->loopin = s_pipe_acquire (self);
+        //  Get last phrase into loopin pipe
+        zs_pipe_pull_greedy (self->loopin, self->stdout);
+        //  Get event and jump if false
+        int64_t event = zs_pipe_recv_whole (self->loopin);
+        if (VM_TRACING)
+            printf ("LOOP event=%" PRId64 "\n", event);
+        if (event > 0)
+            needle++;           //  Skip jump address
+        else
+            needle = needle->target;
+        VM_NEXT;
+    }
+    VM_HANDLER (XLOOP) {
+        //  - pipe op GREEDY (stdout -> loopin)
+        //  - recv event from loopin
+        //  - jump to address if event > 0
+        //  - destroy loopin and pop saved loopin
+        if (zctx_interrupted)
+            return 0;
+        //  Get last phrase into loopin pipe
+        zs_pipe_pull_greedy (self->loopin, self->stdout);
+        //  Get event and jump if true
+        int64_t event = zs_pipe_recv_whole (self->loopin);
+        if (VM_TRACING)
+            printf ("XLOOP event=%" PRId64 "\n", event);
+        if (event > 0)
+            needle = needle->target;
+        else {
+            needle++;           //  Skip jump address
+            //  Restore previous loopin pipe
+            assert (self->loop_stack_ptr > 0);
+            s_pipe_release (self, &self->loopin);
+            self->loopin = self->loop_stack [--self->loop_stack_ptr];
+        }
+        VM_NEXT;
+    }
+    VM_HANDLER (COUNT) {
+        //  - take loop arguments from stdin, as the loop function would
+        //  - jump to address if no cycles
+        //  - else stack loop state and run first cycle
+        word_t *target = (needle++)->target;
+        size_t kind = (needle++)->kind;
+        int64_t cycles = zs_pipe_recv_whole (self->stdin);
+        int64_t index = 1;
+        int64_t delta = 1;
+        if (kind == VM_COUNT_UP) {
+            //  Index start and delta are optional, and default to 1
+            if (zs_pipe_recv (self->stdin))
+                index = zs_pipe_whole (self->stdin);
+            if (zs_pipe_recv (self->stdin))
+                delta = zs_pipe_whole (self->stdin);
+        }
+        if (VM_TRACING)
+            printf ("COUNT kind=%zd cycles=%" PRId64 "\n", kind, cycles);
+        if (cycles > 0) {
+            assert (self->counter_stack_ptr < MAX_LOOP);
+            s_counter_t *counter = &self->counter_stack [self->counter_stack_ptr++];
+            counter->kind = kind;
+            counter->cycles = cycles;
+            counter->index = index;
+            counter->delta = delta;
+            s_counter_cycle (self, counter);
+        }
+        else
+            needle = target;
+        VM_NEXT;
+    }
+    VM_HANDLER (XCOUNT) {
+        //  - jump to address and run next cycle, if any left
+        //  - else unstack loop state
+        if (zctx_interrupted)
+            return 0;
+        assert (self->counter_stack_ptr > 0);
+        s_counter_t *counter = &self->counter_stack [self->counter_stack_ptr - 1];
+        if (VM_TRACING)
+            printf ("XCOUNT cycles=%" PRId64 "\n", counter->cycles);
+        if (counter->cycles > 0) {
+            s_counter_cycle (self, counter);
+            needle = needle->target;
+        }
+        else {
+            needle++;           //  Skip jump address
+            self->counter_stack_ptr--;
+        }
+        VM_NEXT;
+    }
+    VM_HANDLER (JUMP) {
+        //  Jump unconditionally
+        needle = needle->target;
+        if (VM_TRACING)
+            printf ("JUMP address=%zd\n", needle - self->thread);
+        VM_NEXT;
+    }
+    VM_HANDLER (JUMPEX) {
+        //  We expect test value on input pipe
+        int64_t event = zs_pipe_recv_whole (self->stdin);
+        if (VM_TRACING)
+            printf ("JUMPEX event=%" PRId64 "\n", event);
+        //  Jump if next input value is zero or negative
+        if (event > 0)
+            needle++;           //  Skip jump address
+        else
+            needle = needle->target;
+        VM_NEXT;
+    }
+    VM_HANDLER (WHOLE) {
+        int64_t whole = (needle++)->whole;
+        zs_pipe_send_whole (self->stdout, whole);
+        if (VM_TRACING)
+            printf ("WHOLE value=%" PRId64 "\n", whole);
+        VM_NEXT;
+    }
+    VM_HANDLER (WHOLES) {
+        size_t count = (needle++)->count;
+        zs_pipe_send_wholes (self->stdout, &needle->whole, count);
+        if (VM_TRACING)
+            printf ("WHOLES count=%zd\n", count);
+        needle += count;
+        VM_NEXT;
+    }
+    VM_HANDLER (REALS) {
+        size_t count = (needle++)->count;
+        zs_pipe_send_reals (self->stdout, &needle->real, count);
+        if (VM_TRACING)
+            printf ("REALS count=%zd\n", count);
+        needle += count;
+        VM_NEXT;
+    }
+    VM_HANDLER (REAL) {
+        double real = (needle++)->real;
+        zs_pipe_send_real (self->stdout, real);
+        if (VM_TRACING)
+            printf ("REAL value=%g\n", real);
+        VM_NEXT;
+    }
+    VM_HANDLER (STRING) {
+        const char *string = (needle++)->string;
+        zs_pipe_send_constant (self->stdout, string);
+        if (VM_TRACING)
+            printf ("STRING value=%s\n", string);
+        VM_NEXT;
+    }
+    VM_HANDLER (NEST) {
+        if (VM_TRACING)
+            printf ("PIPE op=NEST\n");
+        assert (self->nest_stack_ptr < MAX_NEST);
+        self->nest_stack [self->nest_stack_ptr++] = self->stdout;
+        self->stdout = s_pipe_acquire (self);
+        VM_NEXT;
+    }
+    VM_HANDLER (UNNEST) {
+        if (VM_TRACING)
+            printf ("PIPE op=UNNEST\n");
+        assert (self->nest_stack_ptr > 0);
+        s_pipe_release (self, &self->stdin);
+        self->stdin = self->stdout;
+        self->stdout = self->nest_stack [--self->nest_stack_ptr];
+        VM_NEXT;
+    }
+    VM_HANDLER (SINGLE) {
+        if (VM_TRACING)
+            printf ("PIPE op=SINGLE\n");
+        zs_pipe_pull_single (self->stdin, self->stdout);
+        VM_NEXT;
+    }
+    VM_HANDLER (MODEST) {
+        if (VM_TRACING)
+            printf ("PIPE op=MODEST\n");
+        zs_pipe_pull_modest (self->stdin, self->stdout);
+        VM_NEXT;
+    }
+    VM_HANDLER (GREEDY) {
+        if (VM_TRACING)
+            printf ("PIPE op=GREEDY\n");
+        zs_pipe_pull_greedy (self->stdin, self->stdout);
+        VM_NEXT;
+    }
+    VM_HANDLER (ARRAY) {
+        if (VM_TRACING)
+            printf ("PIPE op=ARRAY\n");
+        zs_pipe_pull_array (self->stdin, self->stdout);
+        VM_NEXT;
+    }
+    VM_HANDLER (UNLOOP) {
+        if (VM_TRACING)
+            printf ("PIPE op=UNLOOP\n");
+        self->loop_fn = true;
+        VM_NEXT;
+    }
+    VM_HANDLER (MARK) {
+        if (VM_TRACING)
+            printf ("PIPE op=MARK\n");
+        zs_pipe_mark (self->stdout);
+        VM_NEXT;
+    }
+    VM_HANDLER (CLEAR) {
+        if (VM_TRACING)
+            printf ("PIPE op=CLEAR\n");
+        zs_pipe_purge (self->stdin);
+        VM_NEXT;
+    }
+    VM_HANDLER (SENTENCE) {
+        if (VM_TRACING)
+            printf ("SENTENCE\n");
+        //  TODO: send results to console/actor pipe
+        //  For now zs_repl grabs results via the zs_vm_results call
+        VM_NEXT;
+    }
+    VM_HANDLER (STOP) {
+        if (VM_TRACING)
+            printf ("STOP\n");
+        return 0;
+    }
+#if !defined (VM_THREADED)
+    }
+    }
+#endif
+}
+
+#undef VM_HANDLER
+#undef VM_NEXT
+#undef VM_CALL_ATOMIC
+#undef VM_INTERPRET
+#undef VM_TRACING